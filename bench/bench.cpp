@@ -0,0 +1,338 @@
+#include "btree.h"
+#include "search.h"
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+const std::string helpMessage = R"(
+B+ Tree Benchmark Suite Usage:
+  ./btree-bench [options]
+
+    --keys N[,N...]            dataset sizes, default 1000,100000,1000000
+    --workloads W[,W...]       insert, read, read-update, scan (default all)
+                                 insert       every key of the dataset once
+                                 read         lookUp only
+                                 read-update  95% lookUp, 5% update
+                                 scan         95% scans of 100 records, 5% inserts of new keys
+    --distributions D[,D...]   sequential, uniform, zipfian (default all)
+    --ops M                    operations per read, read-update and scan run, default 1000000
+    --zipf-theta T             skew of the zipfian distribution, default 0.99
+    --seed S                   default 1
+    --json <file>              also write the results as JSON
+)";
+
+#define SCAN_LENGTH 100
+
+typedef BTree<> Tree;
+
+static volatile uint64_t benchSink; // keeps the reads from being optimized away
+
+/**
+ * Log-linear latency histogram: 16 linear sub-buckets per power of two, so a percentile is
+ * within about 6% of the recorded values at a fixed 8 KiB footprint.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)]++;
+        total++;
+        sum += ns;
+        maxValue = std::max(maxValue, ns);
+    }
+
+    uint64_t percentile(double q) const {
+        uint64_t target = std::max<uint64_t>(1, std::ceil(q * total));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+            seen += counts[bucket];
+            if (seen >= target) {
+                return std::min(maxValue, (lowerBoundOf(bucket) + lowerBoundOf(bucket + 1) - 1) / 2);
+            }
+        }
+        return maxValue;
+    }
+
+    inline uint64_t count() const { return total; }
+    inline uint64_t max() const { return maxValue; }
+    inline double mean() const { return total ? (double)sum / total : 0; }
+
+private:
+    std::array<uint64_t, 64 * SUB_BUCKETS> counts {};
+    uint64_t total = 0, sum = 0, maxValue = 0;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS) {
+            return ns;
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (msb - SUB_BITS)) - SUB_BUCKETS);
+    }
+
+    static uint64_t lowerBoundOf(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) << (msb - SUB_BITS);
+    }
+};
+
+/**
+ * Zipfian ranks over [0, n) after Gray et al. as used by YCSB. Ranks are scrambled by a
+ * hash so the hot keys are spread over the key space instead of sitting in the first leaves.
+ */
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t n, double theta) : n(n), theta(theta) {
+        double zeta2 = 1 + std::pow(0.5, theta);
+        zetan = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            zetan += 1 / std::pow((double)i, theta);
+        }
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        halfPowTheta = 1 + std::pow(0.5, theta);
+    }
+
+    uint64_t next(std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        uint64_t rank = uz < 1 ? 0 : uz < halfPowTheta ? 1 : (uint64_t)(n * std::pow(eta * u - eta + 1, alpha));
+        return scramble(std::min(rank, n - 1)) % n;
+    }
+
+private:
+    uint64_t n;
+    double theta, zetan, alpha, eta, halfPowTheta;
+
+    static uint64_t scramble(uint64_t rank) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (int i = 0; i < 8; i++, rank >>= 8) {
+            hash = (hash ^ (rank & 0xFF)) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+};
+
+/**
+ * Picks which of the n preloaded keys (1..n) an operation targets.
+ */
+class KeyChooser {
+public:
+    KeyChooser(const std::string &distribution, uint64_t n, double theta, uint64_t seed)
+        : distribution(distribution), n(n), position(0), rng(seed) {
+        if (distribution == "zipfian") {
+            zipf = std::make_unique<ZipfianGenerator>(n, theta);
+        }
+    }
+
+    uint64_t next() {
+        if (distribution == "sequential") {
+            return position++ % n + 1;
+        } else if (zipf) {
+            return zipf->next(rng) + 1;
+        }
+        return rng() % n + 1;
+    }
+
+private:
+    std::string distribution;
+    uint64_t n, position;
+    std::mt19937_64 rng;
+    std::unique_ptr<ZipfianGenerator> zipf;
+};
+
+struct BenchOptions {
+    std::vector<uint64_t> keys = {1000, 100000, 1000000};
+    std::vector<std::string> workloads = {"insert", "read", "read-update", "scan"};
+    std::vector<std::string> distributions = {"sequential", "uniform", "zipfian"};
+    uint64_t ops = 1000000;
+    double theta = 0.99;
+    uint64_t seed = 1;
+    std::string jsonPath;
+};
+
+struct RunResult {
+    std::string workload, distribution;
+    uint64_t keys;
+    double seconds;
+    LatencyHistogram latency;
+    size_t height, bytes;
+    double leafFill;
+    bool passed;
+};
+
+template <typename Op>
+inline void timed(LatencyHistogram &latency, Op &&op) {
+    auto start = std::chrono::steady_clock::now();
+    op();
+    auto stop = std::chrono::steady_clock::now();
+    latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+}
+
+/**
+ * One workload over one dataset. insert builds the tree key by key in the order of the
+ * distribution, the others start from a tree bulk loaded with keys 1..n.
+ */
+RunResult runWorkload(const std::string &workload, const std::string &distribution, uint64_t n, const BenchOptions &options) {
+    RunResult result {workload, distribution, n, 0, {}, 0, 0, 0, true};
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    uint64_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    if (workload == "insert") {
+        std::vector<uint64_t> order(n);
+        for (uint64_t i = 0; i < n; i++) {
+            order[i] = i + 1;
+        }
+        if (distribution != "sequential") {
+            std::shuffle(order.begin(), order.end(), std::mt19937_64(options.seed));
+        }
+        start = std::chrono::steady_clock::now();
+        for (uint64_t key : order) {
+            timed(result.latency, [&] { tree->insert(key); });
+        }
+        result.passed = tree->capacity == n;
+    } else {
+        std::vector<Tree::RecordType> records;
+        records.reserve(n);
+        for (uint64_t i = 1; i <= n; i++) {
+            records.push_back(Tree::RecordType {i, i});
+        }
+        tree->bulkLoad(records.begin(), records.end());
+        KeyChooser chooser(distribution, n, options.theta, options.seed);
+        std::mt19937_64 mix(options.seed + 1);
+        uint64_t nextNewKey = n + 1;
+
+        start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < options.ops; i++) {
+            uint64_t key = chooser.next();
+            bool minority = mix() % 100 < 5;
+            if (workload == "read" || (workload == "read-update" && !minority)) {
+                timed(result.latency, [&] { sink += tree->lookUp(key).value_or(0); });
+            } else if (workload == "read-update") {
+                timed(result.latency, [&] { result.passed &= tree->update(key, i); });
+            } else if (!minority) {
+                timed(result.latency, [&] {
+                    int visited = 0;
+                    for (auto cursor = tree->scan(key, UINT64_MAX); cursor.valid() && visited < SCAN_LENGTH; cursor.next()) {
+                        sink += cursor.key();
+                        visited++;
+                    }
+                });
+            } else {
+                timed(result.latency, [&] { tree->insert(Tree::RecordType {nextNewKey++}); });
+            }
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(stop - start).count();
+    result.height = tree->height();
+    result.bytes = tree->arena.bytesInUse();
+    result.leafFill = tree->stats().leafFill;
+    benchSink = sink;
+    return result;
+}
+
+json toJson(const RunResult &result) {
+    return {
+        {"workload", result.workload},
+        {"distribution", result.distribution},
+        {"keys", result.keys},
+        {"ops", result.latency.count()},
+        {"seconds", result.seconds},
+        {"ops_per_second", result.latency.count() / result.seconds},
+        {"latency_ns", {
+            {"p50", result.latency.percentile(0.5)},
+            {"p99", result.latency.percentile(0.99)},
+            {"p999", result.latency.percentile(0.999)},
+            {"max", result.latency.max()},
+            {"mean", result.latency.mean()},
+        }},
+        {"tree", {{"height", result.height}, {"bytes_in_use", result.bytes}, {"leaf_fill", result.leafFill}}},
+        {"passed", result.passed},
+    };
+}
+
+template <typename T>
+std::vector<T> splitList(const std::string &list, T (*parse)(const std::string&)) {
+    std::vector<T> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (getline(stream, item, ',')) {
+        items.push_back(parse(item));
+    }
+    return items;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "-h" || i + 1 == argc) {
+            std::cerr << helpMessage;
+            return flag == "-h" ? 0 : 1;
+        }
+        std::string value = argv[++i];
+        if (flag == "--keys") {
+            options.keys = splitList<uint64_t>(value, [](const std::string &s) { return (uint64_t)std::stoull(s); });
+        } else if (flag == "--workloads") {
+            options.workloads = splitList<std::string>(value, [](const std::string &s) { return s; });
+        } else if (flag == "--distributions") {
+            options.distributions = splitList<std::string>(value, [](const std::string &s) { return s; });
+        } else if (flag == "--ops") {
+            options.ops = std::stoull(value);
+        } else if (flag == "--zipf-theta") {
+            options.theta = std::stod(value);
+        } else if (flag == "--seed") {
+            options.seed = std::stoull(value);
+        } else if (flag == "--json") {
+            options.jsonPath = value;
+        } else {
+            std::cerr << "Unknown flag: " << flag << std::endl << helpMessage;
+            return 1;
+        }
+    }
+
+    json report;
+    report["build"] = {
+        {"compiler", __VERSION__},
+        {"search_path", searchPathName(activeSearchPath())},
+        {"leaf_cap", Tree::Params::leafCap},
+        {"inner_cap", Tree::Params::innerCap},
+    };
+    report["results"] = json::array();
+
+    bool passed = true;
+    for (uint64_t n : options.keys) {
+        for (const std::string &workload : options.workloads) {
+            for (const std::string &distribution : options.distributions) {
+                if (workload == "insert" && distribution == "zipfian") {
+                    continue; // every key is inserted once, there is nothing to skew
+                }
+                RunResult result = runWorkload(workload, distribution, n, options);
+                passed &= result.passed;
+                std::cout << workload << " " << distribution << " " << n << " keys: "
+                          << result.latency.count() << " ops in " << result.seconds << " s ("
+                          << result.latency.count() / result.seconds / 1e6 << " Mops/s), p50 "
+                          << result.latency.percentile(0.5) << " ns, p99 " << result.latency.percentile(0.99)
+                          << " ns, p999 " << result.latency.percentile(0.999) << " ns, leaves "
+                          << result.leafFill * 100 << "% full" << (result.passed ? "" : " [FAILED]") << "\n";
+                report["results"].push_back(toJson(result));
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        out << report.dump(2) << std::endl;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+/**
+ * Nodes refer to each other through 32 bit handles instead of pointers. The top bit
+ * tags leaves so the kind of a node is known without touching it, the next one tags packed
+ * leaves (BTree::compress), and the remaining 30 bits index into the pool for that kind.
+*/
+typedef uint32_t NodeHandle;
+
+#define NULL_HANDLE UINT32_MAX
+#define LEAF_HANDLE_BIT 0x80000000u
+#define PACKED_HANDLE_BIT 0x40000000u
+#define HANDLE_INDEX(handle) ((handle) & ~(LEAF_HANDLE_BIT | PACKED_HANDLE_BIT))
+
+/**
+ * Slab allocator handing out indices. Objects are constructed in place inside fixed size
+ * slabs that are never moved or freed while the pool is alive, so raw pointers returned
+ * by get() stay valid across later allocations.
+ *
+ * The slab directory is replaced rather than reallocated when it grows and old copies are
+ * kept until clear(), so get() may run concurrently with a (single) allocating thread.
+ * Released indices are handed out again by later allocations, which is only safe while no
+ * reader can still be looking at the released object.
+*/
+template <typename T>
+class SlabPool {
+public:
+    static constexpr uint32_t SLAB_SHIFT = 10;
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_SHIFT;
+    static constexpr uint32_t SLAB_MASK = SLAB_SIZE - 1;
+
+    SlabPool() : directory(nullptr), directorySize(0), count(0) {}
+    ~SlabPool() { clear(); }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    template <typename... Args>
+    uint32_t allocate(Args&&... args) {
+        if (!freeList.empty()) {
+            uint32_t index = freeList.back();
+            freeList.pop_back();
+            new (get(index)) T(std::forward<Args>(args)...);
+            return index;
+        }
+        if ((count >> SLAB_SHIFT) == slabs.size()) {
+            addSlab();
+        }
+        uint32_t index = count++;
+        new (get(index)) T(std::forward<Args>(args)...);
+        return index;
+    }
+
+    /**
+     * Claim n consecutive fresh indices without constructing anything, so several threads
+     * can construct() disjoint parts of the range at the same time. Every index of the range
+     * must be constructed before the pool is used in any other way, clear() included.
+    */
+    uint32_t allocateRange(uint32_t n) {
+        while (((count + n + SLAB_MASK) >> SLAB_SHIFT) > slabs.size()) {
+            addSlab();
+        }
+        uint32_t first = count;
+        count += n;
+        return first;
+    }
+
+    template <typename... Args>
+    void construct(uint32_t index, Args&&... args) {
+        new (get(index)) T(std::forward<Args>(args)...);
+    }
+
+    void release(uint32_t index) {
+        get(index)->~T();
+        freeList.push_back(index);
+    }
+
+    inline T* get(uint32_t index) const {
+        T **slabDirectory = directory.load(std::memory_order_acquire);
+        return slabDirectory[index >> SLAB_SHIFT] + (index & SLAB_MASK);
+    }
+
+    /**
+     * Release every object at once. Trivially destructible nodes skip the destructor walk,
+     * which makes tree teardown proportional to the number of slabs rather than nodes.
+    */
+    void clear() {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            std::vector<bool> released(count);
+            for (uint32_t index : freeList) {
+                released[index] = true;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (!released[i]) {
+                    get(i)->~T();
+                }
+            }
+        }
+        freeList.clear();
+        for (T *slab : slabs) {
+            ::operator delete(slab, std::align_val_t(alignof(T)));
+        }
+        slabs.clear();
+        directories.clear();
+        directory.store(nullptr, std::memory_order_relaxed);
+        directorySize = 0;
+        count = 0;
+    }
+
+    inline uint32_t size() const { return count; }
+    inline uint32_t liveCount() const { return count - freeList.size(); }
+    inline size_t bytesReserved() const { return slabs.size() * SLAB_SIZE * sizeof(T); }
+
+private:
+    std::vector<T*> slabs;
+    std::vector<std::unique_ptr<T*[]>> directories; // every directory ever published
+    std::vector<uint32_t> freeList;
+    std::atomic<T**> directory;
+    size_t directorySize;
+    uint32_t count;
+
+    void addSlab() {
+        void *slab = ::operator new(sizeof(T) * SLAB_SIZE, std::align_val_t(alignof(T)));
+        slabs.push_back(static_cast<T*>(slab));
+        publishDirectory();
+    }
+
+    void publishDirectory() {
+        if (slabs.size() <= directorySize) {
+            // the slot is unused so far, readers of the current directory never look at it
+            directories.back()[slabs.size() - 1] = slabs.back();
+            return;
+        }
+        directorySize = directorySize ? directorySize * 2 : 16;
+        directories.push_back(std::make_unique<T*[]>(directorySize));
+        T **slabDirectory = directories.back().get();
+        std::copy(slabs.begin(), slabs.end(), slabDirectory);
+        directory.store(slabDirectory, std::memory_order_release);
+    }
+};
+
+#endif
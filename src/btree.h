@@ -9,25 +9,48 @@
 #include <cstdint>
 #include <queue>
 #include <vector>
+#include <span>
+#include <optional>
+#include <atomic>
+#include <thread>
 #include <algorithm>
+#include <mutex>
+#include <set>
 #include <assert.h>
+#include "arena.h"
+#include "fixed.h"
+#include "packed.h"
+#include "search.h"
+#include "stats.h"
 // #include <nlohmann/json.hpp>
 
-#define LEAF_NODE_CAP 5
-#define INTERNAL_NODE_CAP 3
+#define DEFAULT_PAGE_SIZE 4096
 #define CEIL_CAP(maxCap) (((maxCap) + 1) / 2)
+// Nodes are rebalanced once they drop below a quarter full rather than half, so a burst of
+// deletes followed by inserts does not keep merging and re-splitting the same nodes.
+#define MIN_CAP(maxCap) ((maxCap) / 4 > 0 ? (maxCap) / 4 : 1)
+// Lookups BTree::multiGet keeps in flight, enough misses to cover memory latency
+#define MULTIGET_GROUP 16
+// Nodes retired under live snapshots before a writer checks which of them it may free
+#define RECLAIM_BATCH 64
+// Percent of a full rightmost leaf kept in place when an append splits it. The rest moves to
+// the new leaf with the appended record, leaving a little room for late out of order keys.
+#define APPEND_SPLIT_FILL 90
 
-// Forward Declarations
-class Node;
-class InternalNode;
-class LeafNode;
-
+/**
+ * A key and its value as passed to and from the tree. Leaves do not store Records, they keep
+ * keys and values in separate arrays.
+*/
+template <typename Key = uint64_t, typename Value = uint64_t>
 struct Record {
-    uint64_t key;
-    bool valid;
-    
-    Record(uint64_t k, bool v=true) : key(k), valid(v){}
-    
+    typedef Key KeyType;
+    typedef Value ValueType;
+
+    Key key;
+    Value value;
+
+    Record(Key k, Value val = Value()) : key(k), value(val) {}
+
     bool operator<(const Record& other) const {
         return key < other.key;
     }
@@ -36,89 +59,481 @@ struct Record {
     }
 };
 
+template <typename Key>
 struct InternalRecord {
-    Record record;
-    std::shared_ptr<Node> gtChildPtr;
+    Key key;
+    NodeHandle gtChildPtr;
 };
 
+/**
+ * Number of entries made of one T each that fit in one page, the default fanout of a node.
+ * Leaves pass key and value types separately since they store them in separate arrays,
+ * without padding between the two.
+*/
+template <typename... T>
+constexpr size_t pageFanout() {
+    constexpr size_t entry = (sizeof(T) + ...);
+    return DEFAULT_PAGE_SIZE / entry > 3 ? DEFAULT_PAGE_SIZE / entry : 3;
+}
+
+/**
+ * Compile time configuration shared by every node of one tree instantiation.
+*/
+template <typename K, typename V, size_t LeafCap, size_t InnerCap>
+struct TreeParams {
+    typedef K Key;
+    typedef V Value;
+    typedef Record<K, V> RecordType;
+    typedef InternalRecord<K> InternalRecordType;
+    static constexpr size_t leafCap = LeafCap;
+    static constexpr size_t innerCap = InnerCap;
+
+    static_assert(LeafCap >= 3, "leaves must hold at least 3 records to split");
+    static_assert(InnerCap >= 3, "internal nodes must hold at least 3 keys to split");
+};
+
+// Forward Declarations
+template <typename P> class InternalNode;
+template <typename P> class LeafNode;
+template <typename P> class PlainLeafNode;
+template <typename P> class PackedLeafNode;
+template <typename P> class NodeArena;
+template <typename Key, typename Value> class MappedBTree;
+template <typename Key, typename Value> class FrozenBTree;
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap> class SnapshotView;
+
+template <typename P>
 class Node {
 public:
-    uint64_t id, curCap, maxCap, ceilCap; 
-    std::vector<Record> elements;
-    std::shared_ptr<InternalNode> parent;
+    typedef typename P::Key Key;
+    typedef typename P::RecordType RecordType;
+
+    NodeHandle id, parent;
+    uint64_t curCap, maxCap, ceilCap, minCap;
+    uint64_t epoch; // NodeArena::epoch at creation, see BTree::snapshot
+
+    // Optimistic latch used by ConcurrentBTree: odd while a writer holds the node, bumped
+    // on every release so readers can validate what they read without taking it.
+    std::atomic<uint64_t> version;
 
     Node(uint64_t maxCapacity);
 
-    virtual ~Node();
-    virtual void insert(Record record) = 0;
-    virtual void remove(uint64_t key) = 0;
-    virtual void print() = 0;
-    virtual bool isLeaf() = 0;
+    uint64_t readLock() const;
+    bool validate(uint64_t observed) const;
+    bool tryUpgrade(uint64_t observed);
+    void writeLock();
+    void writeUnlock();
+
+    inline bool canRemove() const { return curCap > minCap; } // without becoming underfull
+    inline bool isUnderfull() const { return curCap < minCap; }
 };
 
-class InternalNode : 
-    public Node,
-    public std::enable_shared_from_this<InternalNode> // necessary for self mutating pushUp()
-{
+template <typename P>
+class InternalNode : public Node<P> {
 public:
-    InternalNode(uint64_t maxCapacity);
-    
-    std::vector<InternalRecord> children;
-    std::shared_ptr<Node> ltChildPtr; // asymmetric less than child
-    
-    void insert(Record record) override;
-    void remove(uint64_t key) override;
-    void print() override;
-    bool isLeaf() override { return false; };
-    
-    void copyUp(std::shared_ptr<LeafNode> leaf);
-    std::shared_ptr<InternalNode> pushUp();
-    void merge();
-    inline bool canInsert() { return (curCap < maxCap ? true : false); } 
-    inline bool canRemove() { return (curCap > 1); }
-    
-    void addChild(InternalRecord child); //helper
-    void removeChild(const InternalRecord& child); //helper
-    std::shared_ptr<Node> findChildPtr(uint64_t key); // helper
-    std::shared_ptr<Node> split();  
+    typedef typename P::Key Key;
+    typedef typename P::RecordType RecordType;
+    typedef typename P::InternalRecordType InternalRecordType;
+
+    InternalNode(uint64_t maxCapacity = P::innerCap);
+
+    // separator keys and the child holding keys >= each of them, stored apart so the
+    // search only streams over keys, and inline so a descent reads them from the node's own
+    // lines; one slot over capacity holds the entry that makes a node split
+    FixedVector<Key, P::innerCap + 1> keys;
+    FixedVector<NodeHandle, P::innerCap + 1> gtChildren;
+    NodeHandle ltChildPtr; // asymmetric less than child
+
+    void insert(NodeArena<P> &arena, RecordType record);
+    void remove(Key key);
+    void print();
+
+    void copyUp(LeafNode<P> *leaf);
+    InternalNode* pushUp(NodeArena<P> &arena);
+    InternalRecordType splitUpperHalf(NodeArena<P> &arena);
+    void merge(NodeArena<P> &arena, InternalNode *right, Key separator);
+    void borrowFromLeft(NodeArena<P> &arena, InternalNode *left, Key &separator);
+    void borrowFromRight(NodeArena<P> &arena, InternalNode *right, Key &separator);
+    inline bool canInsert() { return (this->curCap < this->maxCap ? true : false); }
+
+    void addChild(InternalRecordType child); //helper
+    void removeChild(const InternalRecordType& child); //helper
+    void removeChildAt(size_t slot); // helper
+    NodeHandle findChildPtr(Key key); // helper
+    inline NodeHandle child(size_t slot) const { return slot == 0 ? ltChildPtr : gtChildren[slot - 1]; }
 };
 
-class LeafNode : 
-    public Node,
-    public std::enable_shared_from_this<LeafNode> // necessary for assigning self to splitNode previous leaf
-{
+/**
+ * Leaf as readers see it. It comes in two representations told apart by PACKED_HANDLE_BIT
+ * in its handle: a PlainLeafNode, the only one ever changed, and a PackedLeafNode made by
+ * BTree::compress. The accessors here handle both; writers go through BTree::writable,
+ * which first replaces a packed leaf by a plain copy.
+*/
+template <typename P>
+class LeafNode : public Node<P> {
 public:
+    typedef typename P::Key Key;
+    typedef typename P::Value Value;
+    typedef typename P::RecordType RecordType;
+
     LeafNode(uint64_t maxCapacity);
 
-    std::shared_ptr<LeafNode> nextLeaf;
-    std::shared_ptr<LeafNode> prevLeaf;
+    NodeHandle nextLeaf;
+    NodeHandle prevLeaf;
 
-    void insert(Record record) override;
-    void remove(uint64_t key) override;
-    void merge();
-    void print() override;
-    bool isLeaf() override { return true; };
+    inline bool isPacked() const { return (this->id & PACKED_HANDLE_BIT) != 0; }
+    inline const PlainLeafNode<P>* plain() const { return static_cast<const PlainLeafNode<P>*>(this); }
+    inline const PackedLeafNode<P>* packed() const { return static_cast<const PackedLeafNode<P>*>(this); }
 
-    inline bool canInsert() { return (curCap < ceilCap ? true : false); } 
-    inline bool canRemove() { return (curCap >= ceilCap); }
+    size_t size() const;
+    Key key(size_t slot) const;
+    Value value(size_t slot) const;
+    size_t lowerBound(Key key) const;
+    size_t upperBound(Key key) const;
+    inline RecordType record(size_t slot) const { return RecordType {key(slot), value(slot)}; }
 
-    std::shared_ptr<LeafNode> mergeWithLeftNeighbor();
-    std::shared_ptr<LeafNode> mergeWithRightNeighbor();
-    std::shared_ptr<LeafNode> split();
+    void copyTo(Key *keysOut, Value *valuesOut) const; // every record, packed or not
+    void prefetch(size_t slot) const; // the key and value lines of slot
+    void print();
 };
 
+template <typename P>
+class PlainLeafNode : public LeafNode<P> {
+public:
+    typedef typename P::Key Key;
+    typedef typename P::Value Value;
+    typedef typename P::RecordType RecordType;
+
+    PlainLeafNode(uint64_t maxCapacity = P::leafCap);
+
+    // keys and their values at the same slot, stored apart so searches only touch key lines,
+    // and inline so a lookup reads them from the leaf's own lines; one slot over capacity
+    // holds the record that makes a leaf split
+    FixedVector<Key, P::leafCap + 1> keys;
+    FixedVector<Value, P::leafCap + 1> values;
+
+    inline size_t size() const { return keys.size(); }
+    inline Key key(size_t slot) const { return keys[slot]; }
+    inline Value value(size_t slot) const { return values[slot]; }
+    inline size_t lowerBound(Key key) const { return keyLowerBound(keys.data(), keys.size(), key); }
+    inline size_t upperBound(Key key) const { return keyUpperBound(keys.data(), keys.size(), key); }
+
+    void insert(RecordType record);
+    bool remove(Key key);
+
+    inline bool canInsert() { return (this->curCap < this->maxCap ? true : false); }
+
+    // neighbours are the adjacent leaves in the chain, callers keep to the same parent and
+    // make the neighbour writable first
+    PlainLeafNode* mergeWithLeftNeighbor(NodeArena<P> &arena);
+    PlainLeafNode* mergeWithRightNeighbor(NodeArena<P> &arena);
+    void borrowFromLeft(NodeArena<P> &arena, size_t count);
+    void borrowFromRight(NodeArena<P> &arena, size_t count);
+    PlainLeafNode* split(NodeArena<P> &arena);
+};
+
+/**
+ * Read only leaf keeping its keys, and its values when they fit, frame of reference encoded
+ * (packed.h). Values that do not fit stay plain in a vector trimmed to their count.
+*/
+template <typename P>
+class PackedLeafNode : public LeafNode<P> {
+public:
+    typedef typename P::Key Key;
+    typedef typename P::Value Value;
+
+    PackedLeafNode(uint64_t maxCapacity = P::leafCap);
+
+    PackedArray<Key> packedKeys;
+    PackedArray<Value> packedValues;
+    std::vector<Value> values;
+
+    bool pack(const PlainLeafNode<P> &leaf); // false when the keys span too wide a range to pay off
+    inline size_t packedBytes() const { // element storage outside the node
+        return packedKeys.bytes() + (packedValues.size() ? packedValues.bytes() : values.capacity() * sizeof(Value));
+    }
+};
+
+/**
+ * Owns every node of a tree. Plain leaves, packed leaves and internal nodes live in separate
+ * slab pools and are resolved from their handle with two loads, no reference counting involved.
+*/
+template <typename P>
+class NodeArena {
+public:
+    static inline bool isLeaf(NodeHandle handle) { return (handle & LEAF_HANDLE_BIT) != 0; }
+    static inline bool isPacked(NodeHandle handle) { return (handle & PACKED_HANDLE_BIT) != 0; }
+
+    NodeHandle newLeaf(uint64_t maxCapacity = P::leafCap);
+    NodeHandle newPackedLeaf(uint64_t maxCapacity = P::leafCap);
+    NodeHandle newInternal(uint64_t maxCapacity = P::innerCap);
+
+    // count consecutive leaf handles, each to be set up by one constructLeaf call, possibly
+    // from different threads
+    NodeHandle reserveLeaves(uint32_t count);
+    PlainLeafNode<P>* constructLeaf(NodeHandle handle, uint64_t maxCapacity = P::leafCap);
+    void release(NodeHandle handle); // the handle is reused by a later newLeaf / newInternal
+
+    inline LeafNode<P>* leaf(NodeHandle handle) const {
+        if (isPacked(handle)) {
+            return packedLeaves.get(HANDLE_INDEX(handle));
+        }
+        return plainLeaves.get(HANDLE_INDEX(handle));
+    }
+    inline PlainLeafNode<P>* plainLeaf(NodeHandle handle) const {
+        assert(!isPacked(handle));
+        return plainLeaves.get(HANDLE_INDEX(handle));
+    }
+    inline PackedLeafNode<P>* packedLeaf(NodeHandle handle) const {
+        assert(isPacked(handle));
+        return packedLeaves.get(HANDLE_INDEX(handle));
+    }
+    inline InternalNode<P>* internal(NodeHandle handle) const { return internals.get(handle); }
+    inline Node<P>* node(NodeHandle handle) const {
+        return isLeaf(handle) ? static_cast<Node<P>*>(leaf(handle)) : static_cast<Node<P>*>(internal(handle));
+    }
+
+    inline size_t packedLeafCount() const { return packedLeaves.liveCount(); }
+    size_t bytesReserved() const;
+    size_t bytesInUse() const; // live nodes and the element storage they reserve
+    void clear();
+
+    // kept up to date with every packed leaf filled and released so bytesInUse stays a
+    // constant time sum
+    inline void notePacked(size_t bytes) { packedBytes += bytes; }
+
+    uint64_t epoch = 1; // stamped on every new node, advanced by each BTree::snapshot
+
+private:
+    SlabPool<PlainLeafNode<P>> plainLeaves;
+    SlabPool<PackedLeafNode<P>> packedLeaves;
+    SlabPool<InternalNode<P>> internals;
+    size_t packedBytes = 0;
+};
+
+/**
+ * B+ Tree over Key with a Value payload per record. Leaves hold up to LeafCap records
+ * and internal nodes up to InnerCap separator keys; both default to filling a 4 KiB page.
+*/
+template <typename Key = uint64_t,
+          typename Value = uint64_t,
+          size_t LeafCap = pageFanout<Key, Value>(),
+          size_t InnerCap = pageFanout<InternalRecord<Key>>()>
 class BTree {
 public:
+    typedef TreeParams<Key, Value, LeafCap, InnerCap> Params;
+    typedef Record<Key, Value> RecordType;
+    typedef LeafNode<Params> Leaf;
+    typedef PlainLeafNode<Params> PlainLeaf;
+    typedef PackedLeafNode<Params> PackedLeaf;
+    typedef InternalNode<Params> Internal;
+
+    /**
+     * Position inside the leaf chain bounded to [lo, hi]. next() and prev() follow the
+     * nextLeaf / prevLeaf links and the cursor turns invalid once it leaves the range, after
+     * which it must not be moved. The neighbouring leaf is prefetched while the current one
+     * is being consumed.
+    */
+    class Cursor {
+    public:
+        Cursor(const NodeArena<Params> *arena, NodeHandle leaf, size_t slot, Key lo, Key hi, bool forward = true);
+
+        bool valid() const;
+        Key key() const;
+        Value value() const;
+        inline RecordType record() const { return RecordType {key(), value()}; }
+        void next();
+        void prev();
+
+    private:
+        const NodeArena<Params> *arena;
+        const Leaf *leaf; // null once the chain ran out
+        size_t slot;
+        Key lo, hi;
+
+        void enterLeaf(NodeHandle handle, bool forward);
+    };
+
     BTree();
     ~BTree();
-    uint64_t capacity; 
-    std::shared_ptr<Node> rootNode;
+    uint64_t capacity;
+    NodeArena<Params> arena;
+    NodeHandle rootNode;
+
+    Cursor scan(Key lo, Key hi);        // ascending from the first key >= lo
+    Cursor scanReverse(Key lo, Key hi); // descending from the last key <= hi
 
-    Record lookUp(uint64_t key);
-    std::shared_ptr<LeafNode> findLeafNode(uint64_t key);
+    std::optional<Value> lookUp(Key key); // empty when key is not in the tree
+
+    /**
+     * lookUp for every key, out[i] for keys[i]. Lookups run in groups of MULTIGET_GROUP that
+     * descend level by level in lockstep, prefetching each group's next nodes before any of
+     * them is searched, so the cache misses of a group overlap instead of queueing up.
+    */
+    void multiGet(std::span<const Key> keys, std::span<std::optional<Value>> out);
+    bool update(Key key, Value value); // overwrite the value in place, false when key is absent
+    Leaf* findLeafNode(Key key);
+    Leaf* leftmostLeaf();
+    Leaf* rightmostLeaf();
     void print();
-    void insert(Record record);
-    void remove(uint64_t key);
+    void insert(RecordType record);
+    bool remove(Key key); // false when key is not in the tree
+    size_t height();
+
+    /**
+     * Replace every leaf whose keys fit in 1, 2 or 4 byte offsets from their smallest key
+     * (packed.h) by a packed leaf, packing its values too where they fit. Meant for dense
+     * uint64_t key ranges that are mostly read: lookups and scans search the packed offsets
+     * directly, while the first insert, remove or update of a packed leaf replaces it by a
+     * plain one again until the next compress. Returns the number of leaves packed.
+    */
+    size_t compress();
+
+    /**
+     * The operation counters of stats.h (all zero unless built with BTREE_STATS) together
+     * with the shape of this tree. Visits every node, meant for diagnostics only.
+    */
+    TreeStats stats();
+
+    /**
+     * Replace the contents of the tree with the records in [begin, end). Leaves are packed
+     * left to right to fillFactor of their capacity and the internal levels are built bottom
+     * up in one pass, no splits involved. Unsorted input is sorted first.
+    */
+    template <typename It>
+    void bulkLoad(It begin, It end, double fillFactor = 1.0);
+
+    /**
+     * bulkLoad spread over threads. Unsorted records are sorted in place by parallelSort, then
+     * every thread packs its own contiguous run of leaves. Leaf handles are reserved up front,
+     * so each thread also knows the handles next to its run and links the leaf chain across
+     * runs itself. The internal levels, a few hundred times smaller, are stacked serially.
+    */
+    void bulkLoadParallel(std::vector<RecordType> &records, unsigned threads, double fillFactor = 1.0);
+
+    /**
+     * Insert many records with one root to leaf descent per target leaf instead of one per
+     * record. The span is sorted in place.
+    */
+    void insertBatch(std::span<RecordType> records);
+
+    /**
+     * Write the tree to path in the page file format of pagefile.h, and open such a file
+     * read only without deserializing it. Throw std::runtime_error on I/O or format errors.
+    */
+    void writePages(const std::string &path);
+    static MappedBTree<Key, Value> openMapped(const std::string &path);
+
+    /**
+     * Immutable copy of the tree in a pointer free layout (frozen.h) for indexes that are
+     * only read once built. The tree itself is left as it is and may be dropped.
+    */
+    FrozenBTree<Key, Value> freeze();
+
+    /**
+     * Stream the records to out as a checksummed binary snapshot (snapshot.h), and replace
+     * the contents of the tree with one read from in. Throw std::runtime_error on I/O errors
+     * or a corrupted snapshot.
+    */
+    void save(std::ostream &out);
+    void load(std::istream &in);
+
+    /**
+     * Read only view of the tree as it is now, for lookUp and scan on other threads while
+     * this one keeps writing. Taking it only advances the arena epoch: every node stamped up
+     * to then becomes shared, and a write that would change a shared node first copies it and
+     * the path above it (unshare). Replaced nodes are freed once no live view is old enough
+     * to reach them. The view must not outlive the tree.
+    */
+    SnapshotView<Key, Value, LeafCap, InnerCap> snapshot();
+
+protected:
+    friend class SnapshotView<Key, Value, LeafCap, InnerCap>;
+
+    struct SnapshotEpochs {
+        std::mutex mutex;
+        std::multiset<uint64_t> live; // epoch of every live view, released on any thread
+        std::atomic<size_t> count {0};
+    };
+    uint64_t frozenEpoch = 0; // nodes stamped at or below are shared with a view, 0 for none
+    std::vector<std::pair<uint64_t, NodeHandle>> retired; // replaced shared nodes and the epoch they went in
+    SnapshotEpochs snapshots;
+    NodeHandle appendHint = NULL_HANDLE; // the rightmost leaf when last seen, or none
+
+    bool tryAppend(RecordType record);
+    void splitForAppend(PlainLeaf *leafNode, RecordType record);
+
+    inline bool isShared(NodeHandle handle) const { return arena.node(handle)->epoch <= frozenEpoch; }
+    NodeHandle unshare(NodeHandle handle);
+    NodeHandle copyLeaf(NodeHandle handle);
+    void replaceNode(NodeHandle handle, NodeHandle copy);
+    NodeHandle writable(NodeHandle handle);
+    PlainLeaf* writable(Leaf *leafNode);
+    void retire(NodeHandle handle);
+    void reclaim();
+    void clearNodes();
+
+    struct LevelEntry {
+        Key firstKey;
+        NodeHandle handle;
+    };
+    void buildInternalLevels(std::vector<LevelEntry> &level, double fillFactor);
+    void splitOverfullLeaf(PlainLeaf *leafNode, const std::vector<Key> &keys, const std::vector<Value> &values);
+    void insertSeparator(NodeHandle parentHandle, InternalRecord<Key> child);
+    void publishRoot(NodeHandle handle);
+    void rebalance(NodeHandle handle, Key key);
 };
 
-#endif
\ No newline at end of file
+/**
+ * Number of nodes needed for total entries at perNode each, and how many entries the
+ * i-th of them takes when spread evenly so the last node is not left nearly empty.
+*/
+inline size_t packedNodeCount(size_t total, size_t perNode) {
+    return (total + perNode - 1) / perNode;
+}
+
+inline size_t packedNodeSize(size_t total, size_t nodes, size_t i) {
+    return total / nodes + (i < total % nodes ? 1 : 0);
+}
+
+inline size_t packedNodeOffset(size_t total, size_t nodes, size_t i) { // entries of the nodes before i
+    return i * (total / nodes) + std::min(i, total % nodes);
+}
+
+/**
+ * Run fn(0) .. fn(threads - 1) on as many threads and wait for all of them.
+*/
+template <typename Fn>
+void runThreads(unsigned threads, Fn &&fn) {
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(fn, t);
+    }
+    fn(0);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * Sort items on threads: each sorts one contiguous run, then neighbouring runs are merged
+ * pairwise, half as many merges per round, until one run is left.
+*/
+template <typename T>
+void parallelSort(std::vector<T> &items, unsigned threads);
+
+inline std::string handleName(NodeHandle handle) {
+    if (handle == NULL_HANDLE) {
+        return "null";
+    }
+    const char *kind = (handle & PACKED_HANDLE_BIT) ? "P" : (handle & LEAF_HANDLE_BIT) ? "L" : "I";
+    return kind + std::to_string(HANDLE_INDEX(handle));
+}
+
+#include "btree.tpp"
+#include "pagefile.h"
+#include "snapshot.h"
+#include "view.h"
+#include "frozen.h"
+
+#endif
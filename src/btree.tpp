@@ -0,0 +1,1401 @@
+// Template definitions for btree.h, included at the end of that header.
+
+template <typename P>
+Node<P>::Node(uint64_t maxCapacity) : id(NULL_HANDLE), parent(NULL_HANDLE), curCap(0), maxCap(maxCapacity), ceilCap(CEIL_CAP(maxCapacity)), minCap(MIN_CAP(maxCapacity)), epoch(0), version(0) {}
+
+/**
+ * Wait until no writer holds the node and return the version to validate against.
+*/
+template <typename P>
+uint64_t Node<P>::readLock() const {
+    uint64_t observed = version.load(std::memory_order_acquire);
+    for (int spins = 0; observed & 1; spins++) {
+        if (spins < 64) {
+            __builtin_ia32_pause();
+        } else {
+            std::this_thread::yield(); // the holder may not be running at all
+        }
+        observed = version.load(std::memory_order_acquire);
+    }
+    return observed;
+}
+
+/**
+ * True when nothing was written to the node since readLock() returned observed, i.e. every
+ * plain read made in between saw a consistent node.
+*/
+template <typename P>
+bool Node<P>::validate(uint64_t observed) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == observed;
+}
+
+template <typename P>
+bool Node<P>::tryUpgrade(uint64_t observed) {
+    return version.compare_exchange_strong(observed, observed + 1, std::memory_order_acquire);
+}
+
+template <typename P>
+void Node<P>::writeLock() {
+    while (!tryUpgrade(readLock())) {}
+}
+
+template <typename P>
+void Node<P>::writeUnlock() {
+    version.fetch_add(1, std::memory_order_release);
+}
+
+template <typename P>
+NodeHandle NodeArena<P>::newLeaf(uint64_t maxCapacity) {
+    NodeHandle handle = plainLeaves.allocate(maxCapacity) | LEAF_HANDLE_BIT;
+    plainLeaf(handle)->id = handle;
+    plainLeaf(handle)->epoch = epoch;
+    return handle;
+}
+
+template <typename P>
+NodeHandle NodeArena<P>::newPackedLeaf(uint64_t maxCapacity) {
+    NodeHandle handle = packedLeaves.allocate(maxCapacity) | LEAF_HANDLE_BIT | PACKED_HANDLE_BIT;
+    packedLeaf(handle)->id = handle;
+    packedLeaf(handle)->epoch = epoch;
+    return handle;
+}
+
+template <typename P>
+NodeHandle NodeArena<P>::newInternal(uint64_t maxCapacity) {
+    NodeHandle handle = internals.allocate(maxCapacity);
+    internal(handle)->id = handle;
+    internal(handle)->epoch = epoch;
+    return handle;
+}
+
+template <typename P>
+NodeHandle NodeArena<P>::reserveLeaves(uint32_t count) {
+    return plainLeaves.allocateRange(count) | LEAF_HANDLE_BIT;
+}
+
+template <typename P>
+PlainLeafNode<P>* NodeArena<P>::constructLeaf(NodeHandle handle, uint64_t maxCapacity) {
+    plainLeaves.construct(HANDLE_INDEX(handle), maxCapacity);
+    plainLeaf(handle)->id = handle;
+    plainLeaf(handle)->epoch = epoch;
+    return plainLeaf(handle);
+}
+
+template <typename P>
+void NodeArena<P>::release(NodeHandle handle) {
+    if (isPacked(handle)) {
+        packedBytes -= packedLeaf(handle)->packedBytes();
+        packedLeaves.release(HANDLE_INDEX(handle));
+    } else if (isLeaf(handle)) {
+        plainLeaves.release(HANDLE_INDEX(handle));
+    } else {
+        internals.release(handle);
+    }
+}
+
+template <typename P>
+size_t NodeArena<P>::bytesReserved() const {
+    return plainLeaves.bytesReserved() + packedLeaves.bytesReserved() + internals.bytesReserved();
+}
+
+template <typename P>
+size_t NodeArena<P>::bytesInUse() const {
+    return plainLeaves.liveCount() * sizeof(PlainLeafNode<P>)
+        + packedLeaves.liveCount() * sizeof(PackedLeafNode<P>) + packedBytes
+        + internals.liveCount() * sizeof(InternalNode<P>);
+}
+
+template <typename P>
+void NodeArena<P>::clear() {
+    plainLeaves.clear();
+    packedLeaves.clear();
+    internals.clear();
+    packedBytes = 0;
+}
+
+template <typename P>
+InternalNode<P>::InternalNode(uint64_t maxCapacity) : Node<P>(maxCapacity), ltChildPtr(NULL_HANDLE) {
+    assert(maxCapacity <= P::innerCap);
+}
+
+template <typename P>
+NodeHandle InternalNode<P>::findChildPtr(Key key) {
+    size_t slot = keyUpperBound(keys.data(), keys.size(), key);
+    return slot == 0 ? ltChildPtr : gtChildren[slot - 1];
+}
+
+template <typename P>
+void InternalNode<P>::insert(NodeArena<P> &arena, RecordType record) {
+    // insert a record into a leaf node below
+    NodeHandle child = findChildPtr(record.key);
+    if (child == NULL_HANDLE) {
+        print();
+        std::cout << "child is null "<< record.key << std::endl;
+        return;
+    }
+    [[maybe_unused]] uint64_t visited = 2;
+    while (!NodeArena<P>::isLeaf(child)) {
+        child = arena.internal(child)->findChildPtr(record.key);
+        visited++;
+    }
+    BTREE_STAT(Descents, 1);
+    BTREE_STAT(NodesVisited, visited);
+
+    PlainLeafNode<P> *leafNode = arena.plainLeaf(child);
+    if (leafNode->canInsert()) {
+        leafNode->insert(record);
+    } else {
+        InternalNode *internalParent = arena.internal(leafNode->parent);
+        if (internalParent->canInsert()) {
+            leafNode->insert(record);
+            PlainLeafNode<P> *splitNode = leafNode->split(arena);
+            internalParent->copyUp(splitNode);
+        } else {
+            InternalNode *pushedNode = internalParent->pushUp(arena);
+            pushedNode->insert(arena, record);
+        }
+    }
+    return;
+}
+
+/**
+ * Drop the separator equal to key together with the child to its right.
+*/
+template <typename P>
+void InternalNode<P>::remove(Key key) {
+    size_t slot = keyLowerBound(keys.data(), keys.size(), key);
+    if (slot < keys.size() && keys[slot] == key) {
+        removeChildAt(slot);
+    }
+}
+
+template <typename P>
+void InternalNode<P>::print() {
+    std::cout << "<" << handleName(this->id) << "," << this->curCap << "," << handleName(this->parent) << ">" << "[" << handleName(ltChildPtr);
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::cout << " | " << keys[i] << "* | " << handleName(gtChildren[i]);
+    }
+    std::cout << "]" << std::endl;
+}
+
+template <typename P>
+void InternalNode<P>::copyUp(LeafNode<P> *leaf) {
+    InternalRecordType intRecord = {
+        leaf->key(0),
+        leaf->id
+    };
+    addChild(intRecord);
+}
+
+template <typename P>
+void InternalNode<P>::addChild(InternalRecordType child) {
+    size_t slot = keyLowerBound(keys.data(), keys.size(), child.key);
+    keys.insert(keys.begin() + slot, child.key);
+    gtChildren.insert(gtChildren.begin() + slot, child.gtChildPtr);
+    this->curCap++;
+}
+
+template <typename P>
+void InternalNode<P>::removeChild(const InternalRecordType& targetChild) {
+    size_t slot = keyLowerBound(keys.data(), keys.size(), targetChild.key);
+    if (slot < keys.size() && keys[slot] == targetChild.key) {
+        keys.erase(keys.begin() + slot);
+        gtChildren.erase(gtChildren.begin() + slot);
+        this->curCap--;
+    }
+}
+
+template <typename P>
+void InternalNode<P>::removeChildAt(size_t slot) {
+    keys.erase(keys.begin() + slot);
+    gtChildren.erase(gtChildren.begin() + slot);
+    this->curCap--;
+}
+
+/**
+ * pushUp: split the internal node in two. The middle element is pushed into the parent node.
+ * The leftChildPtr of the middle node now must pont to the lhs Split Node, and the gtChildPtr
+ * must point to the RHS split node.
+ *
+ * @returns a pointer to the node that the split node is pushed into
+*/
+template <typename P>
+InternalNode<P>* InternalNode<P>::pushUp(NodeArena<P> &arena) {
+    BTREE_STAT(PushUps, 1);
+
+    if (this->parent == NULL_HANDLE) {
+        NodeHandle newParent = arena.newInternal();
+        arena.internal(newParent)->ltChildPtr = this->id;
+        this->parent = newParent;
+        BTREE_STAT(RootSplits, 1);
+    }
+    InternalNode *parentNode = arena.internal(this->parent);
+    if (!parentNode->canInsert()) {
+        BTREE_STAT(PushUpCascades, 1);
+        parentNode->pushUp(arena);
+        InternalNode *tempParent = arena.internal(this->parent);
+        while (tempParent->parent != NULL_HANDLE) {
+            tempParent = arena.internal(tempParent->parent);
+        }
+        return tempParent;
+    }
+    parentNode->addChild(splitUpperHalf(arena));
+    return parentNode;
+}
+
+/**
+ * Move the keys above the middle one into a new sibling. The middle key moves to neither
+ * node, it is returned together with the sibling for the caller to insert into the parent.
+*/
+template <typename P>
+typename InternalNode<P>::InternalRecordType InternalNode<P>::splitUpperHalf(NodeArena<P> &arena) {
+    BTREE_STAT(InternalSplits, 1);
+    NodeHandle splitHandle = arena.newInternal();
+    InternalNode *splitNode = arena.internal(splitHandle);
+    size_t middle = this->curCap / 2;
+    InternalRecordType middleRecord = {keys[middle], gtChildren[middle]};
+    arena.node(middleRecord.gtChildPtr)->parent = splitHandle; // TODO: REASON
+
+    splitNode->ltChildPtr = middleRecord.gtChildPtr;
+    middleRecord.gtChildPtr = splitHandle;
+    splitNode->parent = this->parent;
+
+    // the upper half is already sorted, move it over in one go
+    splitNode->keys.assign(keys.begin() + middle + 1, keys.end());
+    splitNode->gtChildren.assign(gtChildren.begin() + middle + 1, gtChildren.end());
+    for (NodeHandle child : splitNode->gtChildren) {
+        arena.node(child)->parent = splitHandle;
+    }
+    splitNode->curCap = splitNode->keys.size();
+    keys.erase(keys.begin() + middle, keys.end()); // drop the moved half and the middle record
+    gtChildren.erase(gtChildren.begin() + middle, gtChildren.end());
+    this->curCap = keys.size();
+    return middleRecord;
+}
+
+/**
+ * Absorb the right sibling. The separator between the two comes down from the parent in
+ * front of the sibling's less than child; the caller drops it and the sibling from there.
+*/
+template <typename P>
+void InternalNode<P>::merge(NodeArena<P> &arena, InternalNode *right, Key separator) {
+    keys.push_back(separator);
+    gtChildren.push_back(right->ltChildPtr);
+    keys.insert(keys.end(), right->keys.begin(), right->keys.end());
+    gtChildren.insert(gtChildren.end(), right->gtChildren.begin(), right->gtChildren.end());
+    arena.node(right->ltChildPtr)->parent = this->id;
+    for (NodeHandle child : right->gtChildren) {
+        arena.node(child)->parent = this->id;
+    }
+    this->curCap = keys.size();
+}
+
+/**
+ * Rotate the last child of the left sibling over: the parent's separator comes down in
+ * front of the current less than child, the sibling's last key goes up to replace it.
+*/
+template <typename P>
+void InternalNode<P>::borrowFromLeft(NodeArena<P> &arena, InternalNode *left, Key &separator) {
+    keys.insert(keys.begin(), separator);
+    gtChildren.insert(gtChildren.begin(), ltChildPtr);
+    ltChildPtr = left->gtChildren.back();
+    arena.node(ltChildPtr)->parent = this->id;
+    separator = left->keys.back();
+    left->keys.pop_back();
+    left->gtChildren.pop_back();
+    left->curCap--;
+    this->curCap++;
+}
+
+template <typename P>
+void InternalNode<P>::borrowFromRight(NodeArena<P> &arena, InternalNode *right, Key &separator) {
+    keys.push_back(separator);
+    gtChildren.push_back(right->ltChildPtr);
+    arena.node(right->ltChildPtr)->parent = this->id;
+    separator = right->keys.front();
+    right->ltChildPtr = right->gtChildren.front();
+    right->keys.erase(right->keys.begin());
+    right->gtChildren.erase(right->gtChildren.begin());
+    right->curCap--;
+    this->curCap++;
+}
+
+template <typename P>
+LeafNode<P>::LeafNode(uint64_t maxCapacity) : Node<P>(maxCapacity), nextLeaf(NULL_HANDLE), prevLeaf(NULL_HANDLE) {}
+
+template <typename P>
+inline size_t LeafNode<P>::size() const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            return packed()->packedKeys.size();
+        }
+    }
+    return plain()->keys.size();
+}
+
+template <typename P>
+inline typename P::Key LeafNode<P>::key(size_t slot) const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            return packed()->packedKeys[slot];
+        }
+    }
+    return plain()->keys[slot];
+}
+
+template <typename P>
+inline typename P::Value LeafNode<P>::value(size_t slot) const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            if constexpr (PackedArray<Value>::supported) {
+                if (packed()->packedValues.size()) {
+                    return packed()->packedValues[slot];
+                }
+            }
+            return packed()->values[slot];
+        }
+    }
+    return plain()->values[slot];
+}
+
+template <typename P>
+inline size_t LeafNode<P>::lowerBound(Key key) const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            return packed()->packedKeys.lowerBound(key);
+        }
+    }
+    return plain()->lowerBound(key);
+}
+
+template <typename P>
+inline size_t LeafNode<P>::upperBound(Key key) const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            return packed()->packedKeys.upperBound(key);
+        }
+    }
+    return plain()->upperBound(key);
+}
+
+template <typename P>
+void LeafNode<P>::copyTo(Key *keysOut, Value *valuesOut) const {
+    if constexpr (PackedArray<Key>::supported) {
+        if (isPacked()) {
+            const PackedLeafNode<P> *packedLeaf = packed();
+            packedLeaf->packedKeys.decode(keysOut);
+            if constexpr (PackedArray<Value>::supported) {
+                if (packedLeaf->packedValues.size()) {
+                    packedLeaf->packedValues.decode(valuesOut);
+                    return;
+                }
+            }
+            std::copy(packedLeaf->values.begin(), packedLeaf->values.end(), valuesOut);
+            return;
+        }
+    }
+    std::copy(plain()->keys.begin(), plain()->keys.end(), keysOut);
+    std::copy(plain()->values.begin(), plain()->values.end(), valuesOut);
+}
+
+template <typename P>
+void LeafNode<P>::prefetch(size_t slot) const {
+    if (isPacked()) {
+        const PackedLeafNode<P> *packedLeaf = packed();
+        __builtin_prefetch(packedLeaf->packedKeys.address(slot));
+        __builtin_prefetch(packedLeaf->packedValues.size() ? packedLeaf->packedValues.address(slot)
+                                                           : static_cast<const void*>(packedLeaf->values.data() + slot));
+        return;
+    }
+    __builtin_prefetch(plain()->keys.data() + slot);
+    __builtin_prefetch(plain()->values.data() + slot);
+}
+
+template <typename P>
+void LeafNode<P>::print() {
+    std::cout << "<" << handleName(this->id) << "," << this->curCap <<  "," << handleName(this->parent) << "," << handleName(nextLeaf) <<">" << "[";
+    for (size_t slot = 0; slot < size(); slot++) { std::cout << key(slot) << "*"; }
+    std::cout << "] ";
+
+}
+
+template <typename P>
+PlainLeafNode<P>::PlainLeafNode(uint64_t maxCapacity) : LeafNode<P>(maxCapacity) {
+    assert(maxCapacity <= P::leafCap);
+}
+
+template <typename P>
+void PlainLeafNode<P>::insert(RecordType record) {
+    // std::cout << "[leaf" << id <<  "] capacity before:" << curCap << std::endl;
+    size_t slot = lowerBound(record.key);
+    keys.insert(keys.begin() + slot, record.key);
+    values.insert(values.begin() + slot, record.value);
+    this->curCap++;
+}
+
+/**
+ * Remove the record with key, rebalancing is up to the caller.
+*/
+template <typename P>
+bool PlainLeafNode<P>::remove(Key key) {
+    size_t slot = lowerBound(key);
+    if (slot == size() || keys[slot] != key) {
+        return false;
+    }
+    keys.erase(keys.begin() + slot);
+    values.erase(values.begin() + slot);
+    this->curCap = keys.size();
+    return true;
+}
+
+/**
+ * Append this leaf to its left neighbour and unlink it from the chain. Returns the
+ * neighbour, this leaf is left empty for the caller to release.
+*/
+template <typename P>
+PlainLeafNode<P>* PlainLeafNode<P>::mergeWithLeftNeighbor(NodeArena<P> &arena) {
+    PlainLeafNode *left = arena.plainLeaf(this->prevLeaf);
+    return left->mergeWithRightNeighbor(arena);
+}
+
+/**
+ * Append the right neighbour to this leaf and unlink it from the chain. Returns this leaf,
+ * the neighbour is left empty for the caller to release.
+*/
+template <typename P>
+PlainLeafNode<P>* PlainLeafNode<P>::mergeWithRightNeighbor(NodeArena<P> &arena) {
+    PlainLeafNode *right = arena.plainLeaf(this->nextLeaf);
+    keys.insert(keys.end(), right->keys.begin(), right->keys.end());
+    values.insert(values.end(), right->values.begin(), right->values.end());
+    this->curCap = keys.size();
+    right->keys.clear();
+    right->values.clear();
+    right->curCap = 0;
+
+    this->nextLeaf = right->nextLeaf;
+    if (this->nextLeaf != NULL_HANDLE) {
+        arena.leaf(this->nextLeaf)->prevLeaf = this->id;
+    }
+    return this;
+}
+
+template <typename P>
+void PlainLeafNode<P>::borrowFromLeft(NodeArena<P> &arena, size_t count) {
+    PlainLeafNode *donor = arena.plainLeaf(this->prevLeaf);
+    keys.insert(keys.begin(), donor->keys.end() - count, donor->keys.end());
+    values.insert(values.begin(), donor->values.end() - count, donor->values.end());
+    donor->keys.erase(donor->keys.end() - count, donor->keys.end());
+    donor->values.erase(donor->values.end() - count, donor->values.end());
+    donor->curCap = donor->keys.size();
+    this->curCap = keys.size();
+}
+
+template <typename P>
+void PlainLeafNode<P>::borrowFromRight(NodeArena<P> &arena, size_t count) {
+    PlainLeafNode *donor = arena.plainLeaf(this->nextLeaf);
+    keys.insert(keys.end(), donor->keys.begin(), donor->keys.begin() + count);
+    values.insert(values.end(), donor->values.begin(), donor->values.begin() + count);
+    donor->keys.erase(donor->keys.begin(), donor->keys.begin() + count);
+    donor->values.erase(donor->values.begin(), donor->values.begin() + count);
+    donor->curCap = donor->keys.size();
+    this->curCap = keys.size();
+}
+
+template <typename P>
+PlainLeafNode<P>* PlainLeafNode<P>::split(NodeArena<P> &arena) {
+
+    BTREE_STAT(LeafSplits, 1);
+    NodeHandle splitHandle = arena.newLeaf();
+    PlainLeafNode *splitNode = arena.plainLeaf(splitHandle);
+    size_t splitIndex = keys.size() / 2;
+    splitNode->keys.assign(keys.begin() + splitIndex, keys.end());
+    splitNode->values.assign(values.begin() + splitIndex, values.end());
+    splitNode->curCap = splitNode->keys.size();
+    keys.erase(keys.begin() + splitIndex, keys.end());
+    values.erase(values.begin() + splitIndex, values.end());
+
+    if (this->nextLeaf != NULL_HANDLE) {
+        splitNode->nextLeaf = this->nextLeaf;
+        arena.leaf(this->nextLeaf)->prevLeaf = splitHandle;
+    }
+    this->nextLeaf = splitHandle;
+    splitNode->parent = this->parent;
+    splitNode->prevLeaf = this->id;
+    this->curCap = keys.size();
+
+    return splitNode;
+}
+
+template <typename P>
+PackedLeafNode<P>::PackedLeafNode(uint64_t maxCapacity) : LeafNode<P>(maxCapacity) {}
+
+/**
+ * Encode the records of leaf. Values that do not fit are copied plain, trimmed to their count.
+*/
+template <typename P>
+bool PackedLeafNode<P>::pack(const PlainLeafNode<P> &leaf) {
+    if constexpr (PackedArray<Key>::supported) {
+        unsigned keyWidth = PackedArray<Key>::widthFor(leaf.keys.data(), leaf.keys.size());
+        if (keyWidth == 0) {
+            return false;
+        }
+        packedKeys.assign(leaf.keys.data(), leaf.keys.size(), keyWidth);
+        unsigned valueWidth = 0;
+        if constexpr (PackedArray<Value>::supported) {
+            valueWidth = PackedArray<Value>::widthFor(leaf.values.data(), leaf.values.size());
+        }
+        if (valueWidth) {
+            packedValues.assign(leaf.values.data(), leaf.values.size(), valueWidth);
+        } else {
+            values.assign(leaf.values.begin(), leaf.values.end());
+        }
+        this->curCap = leaf.curCap;
+        return true;
+    }
+    return false;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+BTree<Key, Value, LeafCap, InnerCap>::BTree() : capacity(0), rootNode(arena.newLeaf()) {}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+BTree<Key, Value, LeafCap, InnerCap>::~BTree() {}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::insert(RecordType record) {
+    BTREE_STAT(Inserts, 1);
+    if (tryAppend(record)) {
+        capacity++;
+        return;
+    }
+    if (frozenEpoch || arena.packedLeafCount()) {
+        writable(findLeafNode(record.key)); // splits only change the leaf and its ancestors
+    }
+
+    if (NodeArena<Params>::isLeaf(rootNode)) {
+        BTREE_STAT(Descents, 1);
+        BTREE_STAT(NodesVisited, 1);
+        PlainLeaf *leafRoot = arena.plainLeaf(rootNode);
+
+        if (leafRoot->canInsert()) {
+            // simple insert
+            leafRoot->insert(record);
+        } else {
+            BTREE_STAT(RootSplits, 1);
+            NodeHandle newRootHandle = arena.newInternal();
+            Internal *newInternalRoot = arena.internal(newRootHandle);
+            PlainLeaf *splitNode = leafRoot->split(arena);
+
+            splitNode->parent = newRootHandle;
+            leafRoot->parent = newRootHandle;
+            newInternalRoot->ltChildPtr = rootNode;
+            newInternalRoot->copyUp(splitNode);
+
+            rootNode = newRootHandle; // assign root to be newly created internal node.
+            newInternalRoot->insert(arena, record);
+        }
+    } else {
+        arena.internal(rootNode)->insert(arena, record);
+    }
+
+    NodeHandle rootParent = arena.node(rootNode)->parent;
+    if (rootParent != NULL_HANDLE) {
+        rootNode = rootParent;
+    }
+    capacity++;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool BTree<Key, Value, LeafCap, InnerCap>::remove(Key key) {
+    BTREE_STAT(Removes, 1);
+
+    Leaf *leafNode = findLeafNode(key);
+    size_t slot = leafNode->lowerBound(key);
+    if (slot == leafNode->size() || leafNode->key(slot) != key) {
+        return false;
+    }
+    PlainLeaf *plainLeaf = writable(leafNode);
+    plainLeaf->remove(key);
+    capacity--;
+    if (plainLeaf->isUnderfull()) {
+        rebalance(plainLeaf->id, key);
+    }
+    return true;
+}
+
+/**
+ * Walk up from an underfull node on the path to key. A sibling under the same parent with
+ * records to spare evens out with it, otherwise the two merge and the parent loses a
+ * separator, which may leave the parent underfull in turn. An internal root left with a
+ * single child is replaced by it.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::rebalance(NodeHandle handle, Key key) {
+    while (true) {
+        Node<Params> *node = arena.node(handle);
+        if (node->parent == NULL_HANDLE) {
+            if (!NodeArena<Params>::isLeaf(handle) && node->curCap == 0) {
+                rootNode = arena.internal(handle)->ltChildPtr;
+                arena.node(rootNode)->parent = NULL_HANDLE;
+                retire(handle);
+                BTREE_STAT(RootCollapses, 1);
+            }
+            return;
+        }
+        if (!node->isUnderfull()) {
+            return;
+        }
+
+        Internal *parent = arena.internal(node->parent);
+        size_t slot = keyUpperBound(parent->keys.data(), parent->keys.size(), key);
+        Node<Params> *left = slot > 0 ? arena.node(parent->child(slot - 1)) : nullptr;
+        Node<Params> *right = slot < parent->keys.size() ? arena.node(parent->child(slot + 1)) : nullptr;
+        bool fromLeft = left && left->canRemove() && (!right || left->curCap >= right->curCap);
+        bool fromRight = !fromLeft && right && right->canRemove();
+        // the node and its parent were made writable on the way down, the sibling may be
+        // shared or packed yet
+        if (fromLeft || (!fromRight && left)) {
+            left = arena.node(writable(left->id));
+        } else {
+            right = arena.node(writable(right->id));
+        }
+
+        if (NodeArena<Params>::isLeaf(handle)) {
+            PlainLeaf *leafNode = arena.plainLeaf(handle);
+            if (fromLeft) {
+                leafNode->borrowFromLeft(arena, (left->curCap - leafNode->curCap + 1) / 2);
+                parent->keys[slot - 1] = leafNode->key(0);
+            } else if (fromRight) {
+                leafNode->borrowFromRight(arena, (right->curCap - leafNode->curCap + 1) / 2);
+                parent->keys[slot] = static_cast<Leaf*>(right)->key(0);
+            } else if (left) {
+                leafNode->mergeWithLeftNeighbor(arena);
+                parent->removeChildAt(slot - 1);
+                retire(handle);
+            } else {
+                leafNode->mergeWithRightNeighbor(arena);
+                parent->removeChildAt(slot);
+                retire(right->id);
+            }
+        } else {
+            Internal *internalNode = static_cast<Internal*>(node);
+            if (fromLeft) {
+                while (internalNode->curCap < left->curCap) {
+                    internalNode->borrowFromLeft(arena, static_cast<Internal*>(left), parent->keys[slot - 1]);
+                }
+            } else if (fromRight) {
+                while (internalNode->curCap < right->curCap) {
+                    internalNode->borrowFromRight(arena, static_cast<Internal*>(right), parent->keys[slot]);
+                }
+            } else if (left) {
+                static_cast<Internal*>(left)->merge(arena, internalNode, parent->keys[slot - 1]);
+                parent->removeChildAt(slot - 1);
+                retire(handle);
+            } else {
+                internalNode->merge(arena, static_cast<Internal*>(right), parent->keys[slot]);
+                parent->removeChildAt(slot);
+                retire(right->id);
+            }
+        }
+        if (fromLeft || fromRight) {
+            BTREE_STAT(Borrows, 1);
+            return;
+        }
+        if (NodeArena<Params>::isLeaf(handle)) {
+            BTREE_STAT(LeafMerges, 1);
+        } else {
+            BTREE_STAT(InternalMerges, 1);
+        }
+        handle = parent->id;
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::print() {
+    if (capacity == 0) {
+        std::cout << "Tree is empty" << std::endl;
+        return;
+    }
+    std::queue<NodeHandle> nodesQueue;
+    nodesQueue.push(rootNode);
+
+    while (!nodesQueue.empty()) {
+        NodeHandle currentHandle = nodesQueue.front();
+        nodesQueue.pop();
+        if (NodeArena<Params>::isLeaf(currentHandle)) {
+            arena.leaf(currentHandle)->print();
+        } else {
+            Internal *internalNode = arena.internal(currentHandle);
+            internalNode->print();
+            if (internalNode->ltChildPtr != NULL_HANDLE) {
+                nodesQueue.push(internalNode->ltChildPtr);
+            }
+            for (NodeHandle child : internalNode->gtChildren) {
+                if (child != NULL_HANDLE) {
+                    nodesQueue.push(child);
+                }
+            }
+        }
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Look up the index of a record based on the key
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::Leaf* BTree<Key, Value, LeafCap, InnerCap>::findLeafNode(Key key) {
+    NodeHandle curNode = rootNode;
+    [[maybe_unused]] uint64_t visited = 1;
+
+    while (curNode != NULL_HANDLE) {
+        if (NodeArena<Params>::isLeaf(curNode)) {
+            BTREE_STAT(Descents, 1);
+            BTREE_STAT(NodesVisited, visited);
+            return arena.leaf(curNode);
+        }
+        curNode = arena.internal(curNode)->findChildPtr(key);
+        visited++;
+    }
+    return nullptr;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::Leaf* BTree<Key, Value, LeafCap, InnerCap>::leftmostLeaf() {
+    NodeHandle curNode = rootNode;
+    while (!NodeArena<Params>::isLeaf(curNode)) {
+        curNode = arena.internal(curNode)->ltChildPtr;
+    }
+    return arena.leaf(curNode);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::Leaf* BTree<Key, Value, LeafCap, InnerCap>::rightmostLeaf() {
+    NodeHandle curNode = rootNode;
+    while (!NodeArena<Params>::isLeaf(curNode)) {
+        Internal *internalNode = arena.internal(curNode);
+        curNode = internalNode->gtChildren.empty() ? internalNode->ltChildPtr : internalNode->gtChildren.back();
+    }
+    return arena.leaf(curNode);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+size_t BTree<Key, Value, LeafCap, InnerCap>::height() {
+    size_t levels = 1;
+    NodeHandle curNode = rootNode;
+    while (!NodeArena<Params>::isLeaf(curNode)) {
+        curNode = arena.internal(curNode)->ltChildPtr;
+        levels++;
+    }
+    return levels;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+size_t BTree<Key, Value, LeafCap, InnerCap>::compress() {
+    size_t packed = 0;
+    for (Leaf *leafNode = leftmostLeaf();;) {
+        if (!leafNode->isPacked()) {
+            PlainLeaf *plainLeaf = writable(leafNode);
+            NodeHandle packedHandle = arena.newPackedLeaf(plainLeaf->maxCap);
+            PackedLeaf *packedLeaf = arena.packedLeaf(packedHandle);
+            if (packedLeaf->pack(*plainLeaf)) {
+                arena.notePacked(packedLeaf->packedBytes());
+                replaceNode(plainLeaf->id, packedHandle);
+                leafNode = packedLeaf;
+                packed++;
+            } else {
+                arena.release(packedHandle);
+                leafNode = plainLeaf;
+            }
+        }
+        if (leafNode->nextLeaf == NULL_HANDLE) {
+            return packed;
+        }
+        leafNode = arena.leaf(leafNode->nextLeaf);
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+TreeStats BTree<Key, Value, LeafCap, InnerCap>::stats() {
+    TreeStats result {};
+    result.operations = StatsRegistry::instance().aggregate();
+    result.height = height();
+    result.bytesInUse = arena.bytesInUse();
+    result.bytesReserved = arena.bytesReserved();
+
+    size_t separators = 0;
+    std::vector<NodeHandle> pending = {rootNode};
+    while (!pending.empty()) {
+        NodeHandle handle = pending.back();
+        pending.pop_back();
+        if (NodeArena<Params>::isLeaf(handle)) {
+            result.leaves++;
+            result.records += arena.leaf(handle)->size();
+        } else {
+            Internal *internalNode = arena.internal(handle);
+            result.internalNodes++;
+            separators += internalNode->keys.size();
+            pending.push_back(internalNode->ltChildPtr);
+            pending.insert(pending.end(), internalNode->gtChildren.begin(), internalNode->gtChildren.end());
+        }
+    }
+    result.leafFill = (double)result.records / (result.leaves * LeafCap);
+    result.internalFill = result.internalNodes ? (double)separators / (result.internalNodes * InnerCap) : 0;
+    return result;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::optional<Value> BTree<Key, Value, LeafCap, InnerCap>::lookUp(Key key) {
+    BTREE_STAT(Lookups, 1);
+
+    Leaf *leafNode = findLeafNode(key);
+    if (leafNode) {
+        size_t slot = leafNode->lowerBound(key);
+        if (slot < leafNode->size() && leafNode->key(slot) == key) {
+            return leafNode->value(slot);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * Every leaf is at the same depth, so a group stays on one level throughout. Each level
+ * takes three passes over the group: pick the children and prefetch their headers, then
+ * prefetch the middle of their key arrays, which needs a header, then search the next
+ * level. By the time a node is searched its lines were requested a group ago.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::multiGet(std::span<const Key> keys, std::span<std::optional<Value>> out) {
+    BTREE_STAT(Lookups, keys.size());
+    NodeHandle handles[MULTIGET_GROUP];
+    for (size_t begin = 0; begin < keys.size(); begin += MULTIGET_GROUP) {
+        size_t count = std::min<size_t>(MULTIGET_GROUP, keys.size() - begin);
+        const Key *group = keys.data() + begin;
+        std::fill_n(handles, count, rootNode);
+        [[maybe_unused]] uint64_t levels = 1;
+
+        while (!NodeArena<Params>::isLeaf(handles[0])) {
+            for (size_t i = 0; i < count; i++) {
+                handles[i] = arena.internal(handles[i])->findChildPtr(group[i]);
+                __builtin_prefetch(arena.node(handles[i]));
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (NodeArena<Params>::isLeaf(handles[i])) {
+                    Leaf *leafNode = arena.leaf(handles[i]);
+                    leafNode->prefetch(leafNode->size() / 2);
+                } else {
+                    Internal *internalNode = arena.internal(handles[i]);
+                    __builtin_prefetch(internalNode->keys.data() + internalNode->keys.size() / 2);
+                }
+            }
+            levels++;
+        }
+        BTREE_STAT(Descents, count);
+        BTREE_STAT(NodesVisited, count * levels);
+
+        for (size_t i = 0; i < count; i++) {
+            Leaf *leafNode = arena.leaf(handles[i]);
+            size_t slot = leafNode->lowerBound(group[i]);
+            if (slot < leafNode->size() && leafNode->key(slot) == group[i]) {
+                out[begin + i] = leafNode->value(slot);
+            } else {
+                out[begin + i] = std::nullopt;
+            }
+        }
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool BTree<Key, Value, LeafCap, InnerCap>::update(Key key, Value value) {
+    Leaf *leafNode = findLeafNode(key);
+    size_t slot = leafNode->lowerBound(key);
+    if (slot == leafNode->size() || leafNode->key(slot) != key) {
+        return false;
+    }
+    writable(leafNode)->values[slot] = value;
+    return true;
+}
+
+/**
+ * Sort the batch, then descend once per target leaf. While descending the nearest separator
+ * right of the path bounds which keys of the batch belong to that leaf; all of them are
+ * merged in at once and an overfull leaf is cut into as many leaves as needed.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::insertBatch(std::span<RecordType> records) {
+    BTREE_STAT(Inserts, records.size());
+    std::sort(records.begin(), records.end());
+
+    std::vector<Key> mergedKeys; // a leaf's records with its part of the batch, when they overflow it
+    std::vector<Value> mergedValues;
+    size_t next = 0;
+    while (next < records.size()) {
+        NodeHandle curNode = rootNode;
+        Key fence = Key();
+        bool bounded = false;
+        while (!NodeArena<Params>::isLeaf(curNode)) {
+            Internal *internalNode = arena.internal(curNode);
+            size_t slot = keyUpperBound(internalNode->keys.data(), internalNode->keys.size(), records[next].key);
+            if (slot < internalNode->keys.size()) {
+                fence = internalNode->keys[slot];
+                bounded = true;
+            }
+            curNode = slot == 0 ? internalNode->ltChildPtr : internalNode->gtChildren[slot - 1];
+        }
+
+        size_t last = records.size();
+        if (bounded) {
+            last = std::lower_bound(records.begin() + next, records.end(), RecordType {fence}) - records.begin();
+        }
+
+        // merge from the back so both arrays are only grown once, existing keys stay in
+        // front of equal ones from the batch; records the leaf cannot hold are merged into
+        // the scratch arrays instead and cut into pieces from there
+        PlainLeaf *leafNode = writable(arena.leaf(curNode));
+        size_t existing = leafNode->keys.size(), total = existing + (last - next);
+        bool fits = total <= leafNode->maxCap;
+        Key *keys = leafNode->keys.data();
+        Value *values = leafNode->values.data();
+        Key *keysOut = keys;
+        Value *valuesOut = values;
+        if (fits) {
+            leafNode->keys.resize(total);
+            leafNode->values.resize(total);
+        } else {
+            mergedKeys.resize(total);
+            mergedValues.resize(total);
+            keysOut = mergedKeys.data();
+            valuesOut = mergedValues.data();
+        }
+        for (size_t batched = last, out = total; batched > next;) {
+            out--;
+            if (existing > 0 && records[batched - 1].key < keys[existing - 1]) {
+                existing--;
+                keysOut[out] = keys[existing];
+                valuesOut[out] = values[existing];
+            } else {
+                batched--;
+                keysOut[out] = records[batched].key;
+                valuesOut[out] = records[batched].value;
+            }
+        }
+        if (fits) {
+            leafNode->curCap = total;
+        } else {
+            std::copy_n(keys, existing, keysOut); // the records before the first batched one
+            std::copy_n(values, existing, valuesOut);
+            splitOverfullLeaf(leafNode, mergedKeys, mergedValues);
+        }
+        capacity += last - next;
+        next = last;
+    }
+}
+
+/**
+ * Spread keys and values, more than the maxCap records of leafNode, over it and as many new
+ * evenly filled leaves as needed. The first part goes to leafNode, every new leaf is linked
+ * into the chain and added to its parent.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::splitOverfullLeaf(PlainLeaf *leafNode, const std::vector<Key> &keys, const std::vector<Value> &values) {
+    size_t total = keys.size();
+    size_t pieces = packedNodeCount(total, leafNode->maxCap);
+    size_t kept = packedNodeSize(total, pieces, 0);
+
+    if (leafNode->parent == NULL_HANDLE) {
+        NodeHandle newRootHandle = arena.newInternal();
+        arena.internal(newRootHandle)->ltChildPtr = leafNode->id;
+        leafNode->parent = newRootHandle;
+        rootNode = newRootHandle;
+        BTREE_STAT(RootSplits, 1);
+    }
+    BTREE_STAT(LeafSplits, pieces - 1);
+
+    leafNode->keys.assign(keys.begin(), keys.begin() + kept);
+    leafNode->values.assign(values.begin(), values.begin() + kept);
+    leafNode->curCap = kept;
+
+    PlainLeaf *left = leafNode;
+    size_t offset = kept;
+    for (size_t i = 1; i < pieces; i++) {
+        size_t count = packedNodeSize(total, pieces, i);
+        NodeHandle pieceHandle = arena.newLeaf();
+        PlainLeaf *piece = arena.plainLeaf(pieceHandle);
+        piece->keys.assign(keys.begin() + offset, keys.begin() + offset + count);
+        piece->values.assign(values.begin() + offset, values.begin() + offset + count);
+        piece->curCap = count;
+
+        piece->nextLeaf = left->nextLeaf;
+        if (left->nextLeaf != NULL_HANDLE) {
+            arena.leaf(left->nextLeaf)->prevLeaf = pieceHandle;
+        }
+        left->nextLeaf = pieceHandle;
+        piece->prevLeaf = left->id;
+
+        insertSeparator(left->parent, {piece->keys.front(), pieceHandle});
+        left = piece;
+        offset += count;
+    }
+}
+
+/**
+ * Insert a record past the largest key straight into the rightmost leaf, without a descent.
+ * The hint is only dropped when its leaf is retired, so a split that went through the
+ * regular path is caught up with along the leaf chain. False when the record is not an
+ * append, or views share the leaf, leaving it to the regular path.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool BTree<Key, Value, LeafCap, InnerCap>::tryAppend(RecordType record) {
+    if (frozenEpoch) {
+        return false;
+    }
+    if (appendHint == NULL_HANDLE) {
+        appendHint = rightmostLeaf()->id;
+    }
+    Leaf *leafNode = arena.leaf(appendHint);
+    while (leafNode->nextLeaf != NULL_HANDLE) {
+        appendHint = leafNode->nextLeaf;
+        leafNode = arena.leaf(appendHint);
+    }
+    if (leafNode->size() == 0 || !(leafNode->key(leafNode->size() - 1) < record.key)) {
+        return false;
+    }
+
+    BTREE_STAT(Appends, 1);
+    PlainLeaf *appendLeaf = writable(leafNode);
+    appendHint = appendLeaf->id;
+    if (appendLeaf->canInsert()) {
+        appendLeaf->keys.push_back(record.key);
+        appendLeaf->values.push_back(record.value);
+        appendLeaf->curCap++;
+    } else {
+        splitForAppend(appendLeaf, record);
+    }
+    return true;
+}
+
+/**
+ * Split the full rightmost leaf for an append. An even split would leave every leaf of a
+ * sequential load half empty for good, so only the records past APPEND_SPLIT_FILL percent
+ * move to the new leaf, followed by the appended one.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::splitForAppend(PlainLeaf *leafNode, RecordType record) {
+    BTREE_STAT(LeafSplits, 1);
+    if (leafNode->parent == NULL_HANDLE) {
+        NodeHandle newRootHandle = arena.newInternal();
+        arena.internal(newRootHandle)->ltChildPtr = leafNode->id;
+        leafNode->parent = newRootHandle;
+        rootNode = newRootHandle;
+        BTREE_STAT(RootSplits, 1);
+    }
+
+    size_t kept = std::max<size_t>(1, leafNode->maxCap * APPEND_SPLIT_FILL / 100);
+    NodeHandle splitHandle = arena.newLeaf();
+    PlainLeaf *splitNode = arena.plainLeaf(splitHandle);
+    splitNode->keys.assign(leafNode->keys.begin() + kept, leafNode->keys.end());
+    splitNode->values.assign(leafNode->values.begin() + kept, leafNode->values.end());
+    splitNode->keys.push_back(record.key);
+    splitNode->values.push_back(record.value);
+    splitNode->curCap = splitNode->keys.size();
+    leafNode->keys.erase(leafNode->keys.begin() + kept, leafNode->keys.end());
+    leafNode->values.erase(leafNode->values.begin() + kept, leafNode->values.end());
+    leafNode->curCap = kept;
+
+    leafNode->nextLeaf = splitHandle;
+    splitNode->prevLeaf = leafNode->id;
+    insertSeparator(leafNode->parent, {splitNode->keys.front(), splitHandle});
+    appendHint = splitHandle;
+}
+
+/**
+ * Add a separator and its right child to an internal node. An overflowing node is split and
+ * its middle key inserted one level up the same way, growing a new root when needed.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::insertSeparator(NodeHandle parentHandle, InternalRecord<Key> child) {
+    Internal *parentNode = arena.internal(parentHandle);
+    parentNode->addChild(child);
+    arena.node(child.gtChildPtr)->parent = parentHandle;
+    if (parentNode->curCap <= parentNode->maxCap) {
+        return;
+    }
+
+    bool growsRoot = parentNode->parent == NULL_HANDLE;
+    if (growsRoot) {
+        BTREE_STAT(RootSplits, 1);
+        NodeHandle newRootHandle = arena.newInternal();
+        arena.internal(newRootHandle)->ltChildPtr = parentHandle;
+        parentNode->parent = newRootHandle;
+    }
+    InternalRecord<Key> middleRecord = parentNode->splitUpperHalf(arena);
+    insertSeparator(parentNode->parent, middleRecord);
+    if (growsRoot) {
+        publishRoot(parentNode->parent); // only once the new root is complete
+    }
+}
+
+/**
+ * Make handle the root. The store is atomic so latch-free readers (ConcurrentBTree) either
+ * see the old root or the fully built new one.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::publishRoot(NodeHandle handle) {
+    std::atomic_ref<NodeHandle>(rootNode).store(handle, std::memory_order_release);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+template <typename It>
+void BTree<Key, Value, LeafCap, InnerCap>::bulkLoad(It begin, It end, double fillFactor) {
+    std::vector<RecordType> sorted;
+    if (!std::is_sorted(begin, end)) {
+        sorted.assign(begin, end);
+        std::sort(sorted.begin(), sorted.end());
+        bulkLoad(sorted.begin(), sorted.end(), fillFactor);
+        return;
+    }
+
+    clearNodes();
+    size_t total = std::distance(begin, end);
+    capacity = total;
+    if (total == 0) {
+        rootNode = arena.newLeaf();
+        return;
+    }
+
+    size_t perLeaf = std::clamp<size_t>(LeafCap * fillFactor, 1, LeafCap);
+    size_t numLeaves = packedNodeCount(total, perLeaf);
+    std::vector<LevelEntry> level;
+    level.reserve(numLeaves);
+
+    It it = begin;
+    PlainLeaf *prevLeaf = nullptr;
+    for (size_t i = 0; i < numLeaves; i++) {
+        NodeHandle handle = arena.newLeaf();
+        PlainLeaf *leaf = arena.plainLeaf(handle);
+        size_t count = packedNodeSize(total, numLeaves, i);
+        for (size_t j = 0; j < count; j++, ++it) {
+            leaf->keys.push_back(it->key);
+            leaf->values.push_back(it->value);
+        }
+        leaf->curCap = count;
+        if (prevLeaf) {
+            prevLeaf->nextLeaf = handle;
+            leaf->prevLeaf = prevLeaf->id;
+        }
+        prevLeaf = leaf;
+        level.push_back({leaf->keys.front(), handle});
+    }
+    buildInternalLevels(level, fillFactor);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::bulkLoadParallel(std::vector<RecordType> &records, unsigned threads, double fillFactor) {
+    threads = std::max(1u, threads);
+    if (!std::is_sorted(records.begin(), records.end())) {
+        parallelSort(records, threads);
+    }
+
+    clearNodes();
+    size_t total = records.size();
+    capacity = total;
+    if (total == 0) {
+        rootNode = arena.newLeaf();
+        return;
+    }
+
+    size_t perLeaf = std::clamp<size_t>(LeafCap * fillFactor, 1, LeafCap);
+    size_t numLeaves = packedNodeCount(total, perLeaf);
+    NodeHandle firstLeaf = arena.reserveLeaves(numLeaves);
+    std::vector<LevelEntry> level(numLeaves);
+    unsigned workers = std::min<size_t>(threads, numLeaves);
+
+    runThreads(workers, [&](unsigned worker) {
+        size_t begin = packedNodeOffset(numLeaves, workers, worker);
+        size_t end = begin + packedNodeSize(numLeaves, workers, worker);
+        for (size_t i = begin; i < end; i++) {
+            NodeHandle handle = firstLeaf + i;
+            PlainLeaf *leaf = arena.constructLeaf(handle);
+            size_t offset = packedNodeOffset(total, numLeaves, i);
+            size_t count = packedNodeSize(total, numLeaves, i);
+            leaf->keys.resize(count);
+            leaf->values.resize(count);
+            for (size_t j = 0; j < count; j++) {
+                leaf->keys[j] = records[offset + j].key;
+                leaf->values[j] = records[offset + j].value;
+            }
+            leaf->curCap = count;
+            leaf->prevLeaf = i > 0 ? handle - 1 : NULL_HANDLE;
+            leaf->nextLeaf = i + 1 < numLeaves ? handle + 1 : NULL_HANDLE;
+            level[i] = {leaf->keys.front(), handle};
+        }
+    });
+    buildInternalLevels(level, fillFactor);
+}
+
+/**
+ * Stack internal nodes over level until a single root remains. Each entry carries the
+ * smallest key below it, which becomes the separator in front of it in the parent.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::buildInternalLevels(std::vector<LevelEntry> &level, double fillFactor) {
+    size_t perNode = std::clamp<size_t>((InnerCap + 1) * fillFactor, 2, InnerCap + 1);
+    while (level.size() > 1) {
+        size_t numNodes = packedNodeCount(level.size(), perNode);
+        std::vector<LevelEntry> parents;
+        parents.reserve(numNodes);
+
+        size_t next = 0;
+        for (size_t i = 0; i < numNodes; i++) {
+            NodeHandle handle = arena.newInternal();
+            Internal *node = arena.internal(handle);
+            size_t count = packedNodeSize(level.size(), numNodes, i);
+
+            node->ltChildPtr = level[next].handle;
+            arena.node(level[next].handle)->parent = handle;
+            for (size_t j = 1; j < count; j++) {
+                node->keys.push_back(level[next + j].firstKey);
+                node->gtChildren.push_back(level[next + j].handle);
+                arena.node(level[next + j].handle)->parent = handle;
+            }
+            node->curCap = node->keys.size();
+            parents.push_back({level[next].firstKey, handle});
+            next += count;
+        }
+        level.swap(parents);
+    }
+    rootNode = level.front().handle;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+BTree<Key, Value, LeafCap, InnerCap>::Cursor::Cursor(const NodeArena<Params> *arena, NodeHandle leaf, size_t slot, Key lo, Key hi, bool forward)
+    : arena(arena), leaf(nullptr), slot(slot), lo(lo), hi(hi) {
+    enterLeaf(leaf, forward);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool BTree<Key, Value, LeafCap, InnerCap>::Cursor::valid() const {
+    if (!leaf) {
+        return false;
+    }
+    Key cur = leaf->key(slot);
+    return !(cur < lo) && !(hi < cur);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+Key BTree<Key, Value, LeafCap, InnerCap>::Cursor::key() const {
+    return leaf->key(slot);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+Value BTree<Key, Value, LeafCap, InnerCap>::Cursor::value() const {
+    return leaf->value(slot);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::Cursor::next() {
+    if (++slot < leaf->size()) {
+        if (slot == leaf->size() / 2 && leaf->nextLeaf != NULL_HANDLE) {
+            // the node header was prefetched on entry, by now its keys and values can follow
+            arena->leaf(leaf->nextLeaf)->prefetch(0);
+        }
+        return;
+    }
+    slot = 0;
+    enterLeaf(leaf->nextLeaf, true);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::Cursor::prev() {
+    if (slot > 0) {
+        if (--slot == leaf->size() / 2 && leaf->prevLeaf != NULL_HANDLE) {
+            Leaf *prevLeaf = arena->leaf(leaf->prevLeaf);
+            prevLeaf->prefetch(prevLeaf->size() - 1);
+        }
+        return;
+    }
+    enterLeaf(leaf->prevLeaf, false);
+}
+
+/**
+ * Move onto handle, skipping empty leaves in the direction of travel. Entering backwards
+ * starts at the last record of the leaf.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::Cursor::enterLeaf(NodeHandle handle, bool forward) {
+    while (handle != NULL_HANDLE && arena->leaf(handle)->size() == 0) {
+        Leaf *emptyLeaf = arena->leaf(handle);
+        handle = forward ? emptyLeaf->nextLeaf : emptyLeaf->prevLeaf;
+    }
+    if (handle == NULL_HANDLE) {
+        leaf = nullptr;
+        return;
+    }
+    leaf = arena->leaf(handle);
+    if (!forward) {
+        slot = leaf->size() - 1;
+    }
+    NodeHandle neighbour = forward ? leaf->nextLeaf : leaf->prevLeaf;
+    if (neighbour != NULL_HANDLE) {
+        __builtin_prefetch(arena->leaf(neighbour));
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::Cursor BTree<Key, Value, LeafCap, InnerCap>::scan(Key lo, Key hi) {
+    Leaf *leafNode = findLeafNode(lo);
+    size_t slot = leafNode->lowerBound(lo);
+    if (slot < leafNode->size()) {
+        return Cursor(&arena, leafNode->id, slot, lo, hi);
+    }
+    return Cursor(&arena, leafNode->nextLeaf, 0, lo, hi);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::Cursor BTree<Key, Value, LeafCap, InnerCap>::scanReverse(Key lo, Key hi) {
+    Leaf *leafNode = findLeafNode(hi);
+    size_t slot = leafNode->upperBound(hi);
+    if (slot > 0) {
+        return Cursor(&arena, leafNode->id, slot - 1, lo, hi);
+    }
+    return Cursor(&arena, leafNode->prevLeaf, 0, lo, hi, false);
+}
+
+template <typename T>
+void parallelSort(std::vector<T> &items, unsigned threads) {
+    // runs below a few thousand items cost more in thread start up than they save
+    size_t runs = std::clamp<size_t>(threads, 1, std::max<size_t>(1, items.size() / 4096));
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= runs; i++) {
+        bounds.push_back(i < runs ? packedNodeOffset(items.size(), runs, i) : items.size());
+    }
+    runThreads(runs, [&](unsigned run) {
+        std::sort(items.begin() + bounds[run], items.begin() + bounds[run + 1]);
+    });
+    while (bounds.size() > 2) {
+        size_t pairs = (bounds.size() - 1) / 2;
+        runThreads(pairs, [&](unsigned pair) {
+            std::inplace_merge(items.begin() + bounds[2 * pair], items.begin() + bounds[2 * pair + 1],
+                               items.begin() + bounds[2 * pair + 2]);
+        });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != items.size()) {
+            merged.push_back(items.size()); // an odd run out waits for the next round
+        }
+        bounds.swap(merged);
+    }
+}
+
+template <typename Tree>
+void traverseLeafChain(const std::unique_ptr<Tree> &tree) {
+
+    typename Tree::Leaf *curLeafNode = tree->leftmostLeaf();
+    while (curLeafNode) {
+        curLeafNode->print();
+        curLeafNode = curLeafNode->nextLeaf != NULL_HANDLE ? tree->arena.leaf(curLeafNode->nextLeaf) : nullptr;
+    }
+}
@@ -0,0 +1,203 @@
+#ifndef CONCURRENT_H
+#define CONCURRENT_H
+
+#include "btree.h"
+#include <mutex>
+
+/**
+ * Thread-safe BTree using optimistic lock coupling. Readers never write shared memory:
+ * they descend reading each node's version, read the node, and validate the version
+ * afterwards, restarting from the root if a writer got in between.
+ *
+ * Inserts that fit into their leaf latch only that leaf. Inserts that split take a tree wide
+ * structure modification mutex and latch exactly the leaf and the ancestors the split
+ * propagates into, so readers and non-splitting writers elsewhere in the tree keep going.
+ *
+ * Only lookUp, findLeafNode and insert are safe to call concurrently; everything else
+ * (bulkLoad, insertBatch, scans, print) expects a quiescent tree.
+*/
+template <typename Key = uint64_t,
+          typename Value = uint64_t,
+          size_t LeafCap = pageFanout<Key, Value>(),
+          size_t InnerCap = pageFanout<InternalRecord<Key>>()>
+class ConcurrentBTree : public BTree<Key, Value, LeafCap, InnerCap> {
+public:
+    typedef BTree<Key, Value, LeafCap, InnerCap> Base;
+    typedef typename Base::RecordType RecordType;
+    typedef typename Base::Leaf Leaf;
+    typedef typename Base::PlainLeaf PlainLeaf; // compress is off, so every leaf is plain
+    typedef typename Base::Internal Internal;
+
+    std::optional<Value> lookUp(Key key);
+    Leaf* findLeafNode(Key key);
+    void insert(RecordType record);
+
+    // the insert replacing a packed leaf would free it while optimistic readers are reading it
+    size_t compress() = delete;
+    // writers latch and change nodes in place, a view would see them change
+    SnapshotView<Key, Value, LeafCap, InnerCap> snapshot() = delete;
+
+private:
+    std::mutex smoMutex; // serializes splits
+
+    bool descend(Key key, PlainLeaf *&leaf, uint64_t &leafVersion);
+    void insertWithSplit(RecordType record);
+};
+
+/**
+ * One optimistic root to leaf pass. Returns false when a node changed underneath and the
+ * caller has to restart, otherwise leaf and the version it was read at.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool ConcurrentBTree<Key, Value, LeafCap, InnerCap>::descend(Key key, PlainLeaf *&leaf, uint64_t &leafVersion) {
+    std::atomic_ref<NodeHandle> root(this->rootNode);
+    NodeHandle curHandle = root.load(std::memory_order_acquire);
+    Node<typename Base::Params> *curNode = this->arena.node(curHandle);
+    uint64_t curVersion = curNode->readLock();
+    if (root.load(std::memory_order_acquire) != curHandle) {
+        BTREE_STAT(Restarts, 1);
+        return false; // the node split into a new root before we got its version
+    }
+
+    [[maybe_unused]] uint64_t visited = 1;
+    while (!NodeArena<typename Base::Params>::isLeaf(curHandle)) {
+        NodeHandle child = static_cast<Internal*>(curNode)->findChildPtr(key);
+        if (!curNode->validate(curVersion)) {
+            BTREE_STAT(Restarts, 1);
+            return false; // the handle may be torn, do not follow it
+        }
+        Node<typename Base::Params> *childNode = this->arena.node(child);
+        uint64_t childVersion = childNode->readLock();
+        if (!curNode->validate(curVersion)) {
+            BTREE_STAT(Restarts, 1);
+            return false;
+        }
+        curHandle = child;
+        curNode = childNode;
+        curVersion = childVersion;
+        visited++;
+    }
+    BTREE_STAT(Descents, 1);
+    BTREE_STAT(NodesVisited, visited);
+    leaf = static_cast<PlainLeaf*>(curNode);
+    leafVersion = curVersion;
+    return true;
+}
+
+/**
+ * The leaf returned was the right one for key when it was reached, it is not latched so
+ * callers that read it concurrently with writers must validate its version themselves.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename ConcurrentBTree<Key, Value, LeafCap, InnerCap>::Leaf* ConcurrentBTree<Key, Value, LeafCap, InnerCap>::findLeafNode(Key key) {
+    PlainLeaf *leaf;
+    uint64_t leafVersion;
+    while (!descend(key, leaf, leafVersion)) {}
+    return leaf;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::optional<Value> ConcurrentBTree<Key, Value, LeafCap, InnerCap>::lookUp(Key key) {
+    BTREE_STAT(Lookups, 1);
+    while (true) {
+        PlainLeaf *leaf;
+        uint64_t leafVersion;
+        if (!descend(key, leaf, leafVersion)) {
+            continue;
+        }
+        // the arrays may be mid shift under a writer, only trust what validates below
+        size_t slot = leaf->lowerBound(key);
+        std::optional<Value> result;
+        if (slot < leaf->size() && leaf->keys[slot] == key) {
+            result = leaf->values[slot];
+        }
+        if (leaf->validate(leafVersion)) {
+            return result;
+        }
+        BTREE_STAT(Restarts, 1);
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ConcurrentBTree<Key, Value, LeafCap, InnerCap>::insert(RecordType record) {
+    BTREE_STAT(Inserts, 1);
+    while (true) {
+        PlainLeaf *leaf;
+        uint64_t leafVersion;
+        if (!descend(record.key, leaf, leafVersion)) {
+            continue;
+        }
+        if (!leaf->canInsert()) {
+            if (!leaf->validate(leafVersion)) {
+                BTREE_STAT(Restarts, 1);
+                continue;
+            }
+            insertWithSplit(record);
+            return;
+        }
+        if (!leaf->tryUpgrade(leafVersion)) {
+            BTREE_STAT(Restarts, 1);
+            continue;
+        }
+        leaf->insert(record);
+        leaf->writeUnlock();
+        std::atomic_ref<uint64_t>(this->capacity).fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+}
+
+/**
+ * Slow path for a full leaf. Parent links are only followed and rewritten here, under
+ * smoMutex, so walking them up to the first ancestor with room is race free; that ancestor
+ * and everything below it on the path is latched before any of them is modified.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ConcurrentBTree<Key, Value, LeafCap, InnerCap>::insertWithSplit(RecordType record) {
+    std::lock_guard<std::mutex> guard(smoMutex);
+
+    PlainLeaf *leaf;
+    while (true) {
+        uint64_t leafVersion;
+        if (descend(record.key, leaf, leafVersion) && leaf->tryUpgrade(leafVersion)) {
+            break;
+        }
+    }
+    std::atomic_ref<uint64_t>(this->capacity).fetch_add(1, std::memory_order_relaxed);
+    if (leaf->canInsert()) {
+        leaf->insert(record); // another split made room meanwhile
+        leaf->writeUnlock();
+        return;
+    }
+
+    std::vector<Node<typename Base::Params>*> latched = {leaf};
+    for (NodeHandle ancestor = leaf->parent; ancestor != NULL_HANDLE;) {
+        Internal *internalNode = this->arena.internal(ancestor);
+        internalNode->writeLock();
+        latched.push_back(internalNode);
+        if (internalNode->canInsert()) {
+            break;
+        }
+        ancestor = internalNode->parent;
+    }
+
+    leaf->insert(record);
+    PlainLeaf *splitNode = leaf->split(this->arena);
+    if (leaf->parent == NULL_HANDLE) {
+        BTREE_STAT(RootSplits, 1);
+        NodeHandle newRootHandle = this->arena.newInternal();
+        Internal *newRoot = this->arena.internal(newRootHandle);
+        newRoot->ltChildPtr = leaf->id;
+        newRoot->copyUp(splitNode);
+        leaf->parent = newRootHandle;
+        splitNode->parent = newRootHandle;
+        this->publishRoot(newRootHandle);
+    } else {
+        this->insertSeparator(leaf->parent, {splitNode->keys.front(), splitNode->id});
+    }
+
+    for (auto *node : latched) {
+        node->writeUnlock();
+    }
+}
+
+#endif
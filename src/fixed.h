@@ -0,0 +1,112 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <assert.h>
+
+/**
+ * Vector of at most Capacity trivially copyable entries stored inline, so a node holding one
+ * keeps its entries in the same allocation as its header and a search reaches them without
+ * following a pointer. Offers the subset of the std::vector interface the nodes use;
+ * exceeding Capacity is a bug caught by assert only. Copies move only the entries in use.
+*/
+template <typename T, size_t Capacity>
+class FixedVector {
+    static_assert(std::is_trivially_copyable_v<T>, "entries are moved with plain copies");
+
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    FixedVector() : count(0) {}
+    FixedVector(const FixedVector &other) : count(other.count) {
+        std::copy_n(other.items, count, items);
+    }
+    FixedVector& operator=(const FixedVector &other) {
+        count = other.count;
+        std::copy_n(other.items, count, items);
+        return *this;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+
+    inline T* data() { return items; }
+    inline const T* data() const { return items; }
+    inline iterator begin() { return items; }
+    inline iterator end() { return items + count; }
+    inline const_iterator begin() const { return items; }
+    inline const_iterator end() const { return items + count; }
+    inline T& operator[](size_t i) { return items[i]; }
+    inline const T& operator[](size_t i) const { return items[i]; }
+    inline T& front() { return items[0]; }
+    inline T& back() { return items[count - 1]; }
+    inline const T& front() const { return items[0]; }
+    inline const T& back() const { return items[count - 1]; }
+
+    inline void clear() { count = 0; }
+
+    inline void resize(size_t n) { // entries grown into are value initialized
+        assert(n <= Capacity);
+        if (n > count) {
+            std::fill(items + count, items + n, T());
+        }
+        count = n;
+    }
+
+    inline void push_back(const T &value) {
+        assert(count < Capacity);
+        items[count++] = value;
+    }
+
+    inline void pop_back() { count--; }
+
+    iterator insert(const_iterator position, const T &value) {
+        assert(count < Capacity);
+        T copy = value; // may live in this vector
+        T *slot = items + (position - items);
+        std::copy_backward(slot, end(), end() + 1);
+        *slot = copy;
+        count++;
+        return slot;
+    }
+
+    template <typename It>
+    iterator insert(const_iterator position, It first, It last) {
+        size_t n = std::distance(first, last);
+        assert(count + n <= Capacity);
+        T *slot = items + (position - items);
+        std::copy_backward(slot, end(), end() + n);
+        std::copy(first, last, slot);
+        count += n;
+        return slot;
+    }
+
+    iterator erase(const_iterator position) {
+        return erase(position, position + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        T *slot = items + (first - items);
+        std::copy(last, const_iterator(end()), slot);
+        count -= last - first;
+        return slot;
+    }
+
+    template <typename It>
+    void assign(It first, It last) {
+        assert((size_t)std::distance(first, last) <= Capacity);
+        count = std::copy(first, last, items) - items;
+    }
+
+private:
+    uint32_t count;
+    T items[Capacity];
+};
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include "btree.h"
+#include <limits>
+
+// Records per block of a FrozenBTree, searched with the node search once the fences found it
+#define FROZEN_BLOCK 32
+// Records per segment of the learned model of a FrozenBTree with unsigned integer keys
+#define FROZEN_MODEL_SEGMENT 64
+// Largest prediction error a segment may have before its lookups go through the fences
+#define FROZEN_MODEL_ERROR 16
+
+/**
+ * How well the learned model of a FrozenBTree fits its keys. The error is the distance
+ * between predicted and actual position, over the keys of the segments that are used.
+*/
+struct FrozenModelStats {
+    size_t segments = 0;
+    size_t fitted = 0;  // segments within FROZEN_MODEL_ERROR, the rest fall back to the fences
+    size_t records = 0; // records in fitted segments
+    double meanError = 0;
+    uint64_t maxError = 0;
+};
+
+/**
+ * Immutable, pointer free copy of a BTree built by BTree::freeze. Keys and values sit in two
+ * arrays in key order, cut into blocks of FROZEN_BLOCK records laid out back to back. The
+ * internal levels are replaced by the last key of every block in Eytzinger order: the fence
+ * at index k has its children at 2k and 2k + 1, so a descent is a single loop over one array
+ * without a handle to resolve, and the top levels every descent shares sit in the first few
+ * cache lines. The fences start on a cache line, so the descendants a few levels below a
+ * fence share one line, which is prefetched while the fence is compared.
+ *
+ * Unsigned integer keys also get a two level learned model. A linear root model maps a key to one of
+ * about size / FROZEN_MODEL_SEGMENT segments, and the segment's own line through its first
+ * and last record predicts the position. The largest error over the segment's records bounds
+ * the window searched around the prediction, so a lookup reads one segment and the lines of
+ * that window. Segments whose error exceeds FROZEN_MODEL_ERROR, where the keys are not close
+ * to uniform, are marked unfit and their keys are found through the fences instead.
+ *
+ * A scan is a walk over the plain arrays.
+*/
+template <typename Key, typename Value>
+class FrozenBTree {
+public:
+    typedef Record<Key, Value> RecordType;
+
+    /**
+     * Ascending position inside [lo, hi], turning invalid past hi or the last record.
+    */
+    class Cursor {
+    public:
+        Cursor(const FrozenBTree *tree, size_t position, Key hi) : tree(tree), position(position), hi(hi) {}
+
+        inline bool valid() const { return position < tree->keys.size() && !(hi < tree->keys[position]); }
+        inline Key key() const { return tree->keys[position]; }
+        inline Value value() const { return tree->values[position]; }
+        inline RecordType record() const { return RecordType {key(), value()}; }
+        inline void next() { position++; }
+
+    private:
+        const FrozenBTree *tree;
+        size_t position;
+        Key hi;
+    };
+
+    template <typename It>
+    FrozenBTree(It begin, It end); // the records of a leaf chain walk, in key order
+    FrozenBTree(FrozenBTree&&) = default;
+    FrozenBTree(const FrozenBTree&) = delete;
+    FrozenBTree& operator=(const FrozenBTree&) = delete;
+
+    uint64_t capacity;
+
+    std::optional<Value> lookUp(Key key) const; // empty when key is not in the tree
+    void multiGet(std::span<const Key> keys, std::span<std::optional<Value>> out) const;
+    Cursor scan(Key lo, Key hi) const; // ascending from the first key >= lo
+    size_t bytesInUse() const;
+    FrozenModelStats modelStats() const;
+    void useModel(bool enabled); // on by default, off searches every key through the fences
+
+private:
+    static constexpr size_t FENCES_PER_LINE = std::max<size_t>(1, 64 / sizeof(Key));
+    static constexpr uint32_t UNFIT = std::numeric_limits<uint32_t>::max();
+
+    struct Segment {
+        double slope; // positions per key
+        Key first;
+        uint32_t begin, end; // records whose keys the root model maps here
+        uint32_t error;      // UNFIT past FROZEN_MODEL_ERROR
+    };
+
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    std::vector<Key> fenceStorage; // room to start fences on a cache line
+    Key *fences;                   // 1 based Eytzinger order, fences[0] unused
+    size_t fenceCount;
+    std::vector<uint32_t> blocks;  // block of each fence
+    std::vector<Segment> segments; // empty for keys that are not unsigned integers
+    double rootSlope;              // segments per key
+    bool modelEnabled;
+
+    size_t fill(size_t index, size_t block);
+    void train();
+    const Segment *segmentOf(Key key) const; // nullptr without a model
+    size_t predict(const Segment &segment, Key key) const;
+    size_t lowerBound(Key key) const; // position of the first key >= key, or the size
+    size_t searchBlock(size_t fence, Key key) const;
+    size_t searchWindow(const Segment &segment, size_t prediction, Key key) const;
+};
+
+template <typename Key, typename Value>
+template <typename It>
+FrozenBTree<Key, Value>::FrozenBTree(It begin, It end) : capacity(0) {
+    for (It it = begin; it != end; ++it) {
+        keys.push_back(it->key);
+        values.push_back(it->value);
+    }
+    capacity = keys.size();
+    fenceCount = packedNodeCount(keys.size(), FROZEN_BLOCK);
+    fenceStorage.resize(fenceCount + 1 + FENCES_PER_LINE);
+    size_t misalignment = reinterpret_cast<uintptr_t>(fenceStorage.data()) % 64 / sizeof(Key);
+    fences = fenceStorage.data() + (misalignment ? FENCES_PER_LINE - misalignment : 0);
+    blocks.resize(fenceCount + 1);
+    fill(1, 0);
+    rootSlope = 0;
+    modelEnabled = true;
+    if constexpr (std::is_unsigned_v<Key>) {
+        train();
+    }
+}
+
+/**
+ * In order walk of the implicit tree below index, which hands out the blocks from block on
+ * in ascending order. Returns the block after the last one placed.
+*/
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::fill(size_t index, size_t block) {
+    if (index > fenceCount) {
+        return block;
+    }
+    block = fill(2 * index, block);
+    fences[index] = keys[std::min(keys.size(), (block + 1) * FROZEN_BLOCK) - 1];
+    blocks[index] = block;
+    return fill(2 * index + 1, block + 1);
+}
+
+/**
+ * Route every record through the root model, which is monotonic, so each segment gets a
+ * contiguous run of records, then fit each segment and record its largest error. A key the
+ * root model sends to a segment has its lower bound inside that run or at its end, and
+ * since the segment's prediction is monotonic too, within error of the prediction.
+*/
+template <typename Key, typename Value>
+void FrozenBTree<Key, Value>::train() {
+    if (keys.empty() || keys.size() >= UNFIT) {
+        return;
+    }
+    segments.resize(std::max<size_t>(1, keys.size() / FROZEN_MODEL_SEGMENT));
+    rootSlope = segments.size() / ((double)(keys.back() - keys.front()) + 1);
+    size_t position = 0;
+    for (size_t index = 0; index < segments.size(); index++) {
+        Segment &segment = segments[index];
+        segment.begin = position;
+        while (position < keys.size() && segmentOf(keys[position]) == &segment) {
+            position++;
+        }
+        segment.end = position;
+        segment.first = segment.begin < segment.end ? keys[segment.begin] : Key();
+        Key span = segment.begin < segment.end ? keys[segment.end - 1] - segment.first : 0;
+        segment.slope = span ? (segment.end - segment.begin - 1) / (double)span : 0;
+        segment.error = 0;
+        for (size_t slot = segment.begin; slot < segment.end; slot++) {
+            size_t predicted = predict(segment, keys[slot]);
+            segment.error = std::max<uint32_t>(segment.error, predicted > slot ? predicted - slot : slot - predicted);
+        }
+        if (segment.error > FROZEN_MODEL_ERROR) {
+            segment.error = UNFIT;
+        }
+    }
+}
+
+template <typename Key, typename Value>
+const typename FrozenBTree<Key, Value>::Segment *FrozenBTree<Key, Value>::segmentOf(Key key) const {
+    if constexpr (std::is_unsigned_v<Key>) {
+        if (segments.empty()) {
+            return nullptr;
+        }
+        double index = key > keys.front() ? rootSlope * (double)(key - keys.front()) : 0;
+        return &segments[std::min<size_t>(segments.size() - 1, (size_t)index)];
+    }
+    return nullptr;
+}
+
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::predict(const Segment &segment, Key key) const {
+    double offset = key > segment.first ? segment.slope * (double)(key - segment.first) : 0;
+    return segment.begin + (size_t)std::min<double>(offset, segment.end - segment.begin);
+}
+
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::searchWindow(const Segment &segment, size_t prediction, Key key) const {
+    size_t first = prediction > segment.begin + segment.error ? prediction - segment.error : segment.begin;
+    size_t last = std::min<size_t>(segment.end, prediction + segment.error + 1);
+    return first + keyLowerBound(keys.data() + first, last - first, key);
+}
+
+/**
+ * The descent goes left while the fence is >= key, so the last left turn was taken at the
+ * first block ending at or above key. Undoing the right turns after it, the trailing ones
+ * of index, gets back to that fence; an index of only right turns means every block ends
+ * below key.
+*/
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::lowerBound(Key key) const {
+    const Segment *segment = modelEnabled ? segmentOf(key) : nullptr;
+    if (segment && segment->error != UNFIT) {
+        return searchWindow(*segment, predict(*segment, key), key);
+    }
+    size_t index = 1;
+    while (index <= fenceCount) {
+        __builtin_prefetch(fences + std::min(index * FENCES_PER_LINE, fenceCount));
+        index = 2 * index + (fences[index] < key);
+    }
+    index >>= __builtin_ffsll(~index);
+    return index ? searchBlock(index, key) : keys.size();
+}
+
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::searchBlock(size_t fence, Key key) const {
+    size_t first = (size_t)blocks[fence] * FROZEN_BLOCK;
+    size_t count = std::min<size_t>(FROZEN_BLOCK, keys.size() - first);
+    return first + keyLowerBound(keys.data() + first, count, key);
+}
+
+template <typename Key, typename Value>
+std::optional<Value> FrozenBTree<Key, Value>::lookUp(Key key) const {
+    size_t position = lowerBound(key);
+    if (position < keys.size() && keys[position] == key) {
+        return values[position];
+    }
+    return std::nullopt;
+}
+
+/**
+ * Groups of MULTIGET_GROUP descents step through the levels together, each prefetching its
+ * next lines, so their misses overlap as in BTree::multiGet. Every descent takes the same
+ * number of steps give or take the last level, which the loop condition covers. Keys in a
+ * fitted segment skip the descent: their segments and then their predicted positions are
+ * prefetched for the whole group before any window is searched.
+*/
+template <typename Key, typename Value>
+void FrozenBTree<Key, Value>::multiGet(std::span<const Key> probes, std::span<std::optional<Value>> out) const {
+    size_t indices[MULTIGET_GROUP];
+    const Segment *fitted[MULTIGET_GROUP];
+    for (size_t begin = 0; begin < probes.size(); begin += MULTIGET_GROUP) {
+        size_t groupSize = std::min<size_t>(MULTIGET_GROUP, probes.size() - begin);
+        const Key *group = probes.data() + begin;
+        for (size_t i = 0; i < groupSize; i++) {
+            fitted[i] = modelEnabled ? segmentOf(group[i]) : nullptr;
+            __builtin_prefetch(fitted[i]);
+        }
+        bool descending = false;
+        for (size_t i = 0; i < groupSize; i++) {
+            if (fitted[i] && fitted[i]->error != UNFIT) {
+                indices[i] = predict(*fitted[i], group[i]);
+                __builtin_prefetch(keys.data() + indices[i]);
+            } else {
+                fitted[i] = nullptr;
+                indices[i] = 1;
+                descending = fenceCount > 0;
+            }
+        }
+        while (descending) {
+            descending = false;
+            for (size_t i = 0; i < groupSize; i++) {
+                if (!fitted[i] && indices[i] <= fenceCount) {
+                    __builtin_prefetch(fences + std::min(indices[i] * FENCES_PER_LINE, fenceCount));
+                    indices[i] = 2 * indices[i] + (fences[indices[i]] < group[i]);
+                    descending = true;
+                }
+            }
+        }
+        for (size_t i = 0; i < groupSize; i++) {
+            if (fitted[i]) {
+                continue;
+            }
+            size_t index = indices[i] >> __builtin_ffsll(~indices[i]);
+            __builtin_prefetch(keys.data() + (index ? (size_t)blocks[index] * FROZEN_BLOCK + FROZEN_BLOCK / 2 : 0));
+            indices[i] = index;
+        }
+        for (size_t i = 0; i < groupSize; i++) {
+            size_t position = fitted[i] ? searchWindow(*fitted[i], indices[i], group[i])
+                : indices[i] ? searchBlock(indices[i], group[i]) : keys.size();
+            if (position < keys.size() && keys[position] == group[i]) {
+                out[begin + i] = values[position];
+            } else {
+                out[begin + i] = std::nullopt;
+            }
+        }
+    }
+}
+
+template <typename Key, typename Value>
+typename FrozenBTree<Key, Value>::Cursor FrozenBTree<Key, Value>::scan(Key lo, Key hi) const {
+    return Cursor(this, lowerBound(lo), hi);
+}
+
+template <typename Key, typename Value>
+size_t FrozenBTree<Key, Value>::bytesInUse() const {
+    return sizeof(*this) + keys.size() * sizeof(Key) + values.size() * sizeof(Value)
+        + fenceStorage.size() * sizeof(Key) + blocks.size() * sizeof(uint32_t) + segments.size() * sizeof(Segment);
+}
+
+template <typename Key, typename Value>
+FrozenModelStats FrozenBTree<Key, Value>::modelStats() const {
+    FrozenModelStats stats;
+    stats.segments = segments.size();
+    for (const Segment &segment : segments) {
+        if (segment.error == UNFIT) {
+            continue;
+        }
+        stats.fitted++;
+        stats.maxError = std::max<uint64_t>(stats.maxError, segment.error);
+        for (size_t slot = segment.begin; slot < segment.end; slot++) {
+            size_t predicted = predict(segment, keys[slot]);
+            stats.meanError += predicted > slot ? predicted - slot : slot - predicted;
+        }
+        stats.records += segment.end - segment.begin;
+    }
+    stats.meanError = stats.records ? stats.meanError / stats.records : 0;
+    return stats;
+}
+
+template <typename Key, typename Value>
+void FrozenBTree<Key, Value>::useModel(bool enabled) {
+    modelEnabled = enabled;
+}
+
+/**
+ * Records are copied out of packed and plain leaves alike along the leaf chain.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+FrozenBTree<Key, Value> BTree<Key, Value, LeafCap, InnerCap>::freeze() {
+    std::vector<RecordType> records;
+    records.reserve(capacity);
+    for (auto cursor = scan(std::numeric_limits<Key>::lowest(), std::numeric_limits<Key>::max()); cursor.valid(); cursor.next()) {
+        records.push_back(cursor.record());
+    }
+    return FrozenBTree<Key, Value>(records.begin(), records.end());
+}
+
+#endif
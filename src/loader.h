@@ -0,0 +1,178 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "btree.h"
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Key files come in two formats. Text files hold a count line and then one decimal key per
+ * line; the text is cut into one chunk per thread at line boundaries, every chunk is parsed
+ * with from_chars on its own thread straight out of the mapped file and the chunks are
+ * concatenated in file order. Binary files (tests/gen.py --binary) hold a KeyFileHeader and
+ * then count little endian uint64_t keys, which load with a single copy.
+*/
+#define KEY_FILE_MAGIC "BTKEYS1"
+
+struct KeyFileHeader {
+    char magic[8];
+    uint64_t count;
+};
+
+/**
+ * Read only mapping of a whole file, unmapped again on destruction.
+*/
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) : base(nullptr), length(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can not open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("can not stat " + path);
+        }
+        length = st.st_size;
+        if (length) {
+            void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("can not map " + path);
+            }
+            base = static_cast<char*>(mapping);
+            madvise(base, length, MADV_SEQUENTIAL);
+        }
+        close(fd); // the mapping keeps the file referenced
+    }
+    ~MappedFile() {
+        if (base) {
+            munmap(base, length);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline const char* data() const { return base; }
+    inline const char* end() const { return base + length; }
+    inline size_t size() const { return length; }
+
+private:
+    char *base;
+    size_t length;
+};
+
+/**
+ * Append the keys in [begin, end) to keys. Returns the first character that is neither
+ * whitespace nor part of a key, or nullptr when the whole range parsed.
+*/
+inline const char* parseKeyRange(const char *begin, const char *end, std::vector<uint64_t> &keys) {
+    for (const char *p = begin; p < end;) {
+        if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t') {
+            p++;
+            continue;
+        }
+        uint64_t key;
+        auto [next, error] = std::from_chars(p, end, key);
+        if (error != std::errc()) {
+            return p;
+        }
+        keys.push_back(key);
+        p = next;
+    }
+    return nullptr;
+}
+
+inline std::vector<uint64_t> parseKeys(const char *begin, const char *end, unsigned threads) {
+    size_t bytes = end - begin;
+    // below a few pages a chunk costs more to hand to a thread than to parse
+    unsigned chunks = std::clamp<size_t>(threads, 1, std::max<size_t>(1, bytes / 16384));
+    std::vector<const char*> bounds = {begin};
+    for (unsigned i = 1; i < chunks; i++) {
+        const char *cut = std::max(bounds.back(), begin + packedNodeOffset(bytes, chunks, i));
+        while (cut < end && *cut != '\n') {
+            cut++;
+        }
+        bounds.push_back(cut);
+    }
+    bounds.push_back(end);
+
+    std::vector<std::vector<uint64_t>> parsed(chunks);
+    std::vector<const char*> errors(chunks);
+    runThreads(chunks, [&](unsigned chunk) {
+        parsed[chunk].reserve((bounds[chunk + 1] - bounds[chunk]) / 8);
+        errors[chunk] = parseKeyRange(bounds[chunk], bounds[chunk + 1], parsed[chunk]);
+    });
+    for (const char *error : errors) {
+        if (error) {
+            throw std::runtime_error("unexpected character in key file at offset " + std::to_string(error - begin));
+        }
+    }
+
+    std::vector<uint64_t> keys = std::move(parsed[0]);
+    for (unsigned chunk = 1; chunk < chunks; chunk++) {
+        keys.insert(keys.end(), parsed[chunk].begin(), parsed[chunk].end());
+    }
+    return keys;
+}
+
+/**
+ * Parse a key file in either format, text on threads threads. Throws std::runtime_error when
+ * the file can not be read or is malformed.
+*/
+inline std::vector<uint64_t> readKeyFile(const std::string &path, unsigned threads) {
+    MappedFile file(path);
+    KeyFileHeader header;
+    if (file.size() >= sizeof(header) && std::memcmp(file.data(), KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC)) == 0) {
+        std::memcpy(&header, file.data(), sizeof(header));
+        if constexpr (std::endian::native == std::endian::big) {
+            header.count = __builtin_bswap64(header.count);
+        }
+        size_t body = file.size() - sizeof(header);
+        if (body % sizeof(uint64_t) != 0 || body / sizeof(uint64_t) != header.count) {
+            throw std::runtime_error("binary key file " + path + " does not match its key count");
+        }
+        std::vector<uint64_t> keys(header.count);
+        std::memcpy(keys.data(), file.data() + sizeof(header), header.count * sizeof(uint64_t));
+        if constexpr (std::endian::native == std::endian::big) {
+            for (uint64_t &key : keys) {
+                key = __builtin_bswap64(key);
+            }
+        }
+        return keys;
+    }
+    const char *body = std::find(file.data(), file.end(), '\n');
+    return parseKeys(body == file.end() ? body : body + 1, file.end(), threads);
+}
+
+/**
+ * Write keys as a binary key file.
+*/
+inline void writeKeyFile(const std::string &path, const std::vector<uint64_t> &keys) {
+    KeyFileHeader header = {};
+    std::memcpy(header.magic, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC));
+    header.count = keys.size();
+    std::vector<uint64_t> littleEndian(keys);
+    if constexpr (std::endian::native == std::endian::big) {
+        header.count = __builtin_bswap64(header.count);
+        for (uint64_t &key : littleEndian) {
+            key = __builtin_bswap64(key);
+        }
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(littleEndian.data()), littleEndian.size() * sizeof(uint64_t));
+    if (!out) {
+        throw std::runtime_error("failed writing key file " + path);
+    }
+}
+
+#endif
@@ -1,7 +1,16 @@
 #include "tests.h"
 #include "btree.h"
 #include "serialize.h"
+#include "wal.h"
+#include "loader.h"
+#include "server.h"
+#include <csignal>
 #include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <filesystem>
 #include <nlohmann/json.hpp>
 
 const std::string helpMessage = R"(
@@ -9,20 +18,72 @@ B+ Tree Program Usage:
 
   Modes of Operation:
     1. Interactive Mode: Run in interactive mode 
-       Usage: ./btree -i
+       Usage: ./btree -i [--snapshot <file>] [--wal <file>] [--group-commit N] [--group-window-ms T]
+       One JSON object per line: {"insert": k}, {"insert_batch": [k, ...]}, {"remove": k},
+       {"command": "json_state"}, {"command": "save" | "load", "path": "<snapshot>"},
+       {"command": "checkpoint"}, {"command": "stats"}, {"command": "compress"}
+       With --wal every mutation is logged and synced in groups of N records or after T ms
+       (defaults 256 and 5), and the log is replayed on start on top of the --snapshot file.
+       checkpoint rewrites the snapshot and empties the log. stats reports operation counters
+       (built with make STATS=1), hardware counters around the mutations and the tree shape.
+       compress packs the leaves of dense key ranges, see BTree::compress.
 
     2. Run Benchmarks: Fill the tree with indexes from a file.
-       Usage: ./btree -b <file_name>
-       File Format: See tests
+       Usage: ./btree -b <file_name> [--threads N] [--stats]
+       File Format: See tests, or a binary key file from tests/gen.py --binary. The file is
+       parsed once up front and the parse time reported on its own.
+       With --threads, measures concurrent insert and lookup scaling from 1 to N threads,
+       on a ConcurrentBTree and on a ShardedBTree with one shard per thread.
+       With --stats, also breaks insert and lookup cost down by tree size using the
+       operation and hardware counters.
 
     3. Test Mode:
        Usage: ./btree -t <file_name> 
+
+    4. Bulk Load Test Mode: Same tests, tree built bottom up from the file in one pass.
+       Usage: ./btree -l <file_name> [fill_factor]
+
+    5. Parallel Build: Build the tree from the file with bulkLoadParallel on 1, 2, 4, ... N
+       threads and report parse, sort and pack times against the serial insert path.
+       Usage: ./btree -p <file_name> [--threads N]
+       Accepts text and binary key files like -b.
+       N defaults to every core (also --threads 0).
+
+    6. Server Mode: Serve the tree over a Unix domain socket, and a loopback TCP port with
+       --tcp (0 picks a free port), until SIGINT or SIGTERM.
+       Usage: ./btree -s <socket_path> [--tcp PORT] [--snapshot <file>] [--wal <file>] [...]
+       Speaks the length prefixed binary protocol of src/server.h: pipelined insert, lookup,
+       remove and scan requests answered in order. Snapshot and log options as for -i.
 )";
 
+/**
+ * Start program in bulk load testing mode with -l
+ */
+template <typename Tree>
+void handleBulkLoadTests(const std::unique_ptr<Tree> &tree, std::ifstream &file, double fillFactor) {
+
+    std::string line;
+    std::cout << "{" << std::endl;
+    if (file.is_open()) {
+        if (getline(file, line)) {
+            int numIndicies = std::stoi(line);
+
+            std::cout << "\t\"testBulkLoad\":" << testBulkLoad(tree, numIndicies, file, fillFactor) << "," << std::endl;
+            std::cout << "\t\"testLookUp\":" << testLookUp(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testMultiGet\":" << testMultiGet(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testLeafChain\":" << testLeafChain(tree) << "," << std::endl;
+            std::cout << "\t\"testRangeScan\":" << testRangeScan(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testCompression\":" << testCompression(tree, numIndicies) << std::endl;
+        }
+    }
+    std::cout << "}" << std::endl;
+}
+
 /**
  * Start program in testing mode with -t 
  */
-void handleTests(const std::unique_ptr<BTree> &tree, std::ifstream &file) {
+template <typename Tree>
+void handleTests(const std::unique_ptr<Tree> &tree, std::ifstream &file) {
     
     std::string line;
     std::cout << "{" << std::endl; 
@@ -34,50 +95,921 @@ void handleTests(const std::unique_ptr<BTree> &tree, std::ifstream &file) {
             std::cout << "\t\"testInsert\":" << testInsert(tree, numIndicies, file) << "," << std::endl; 
             file.seekg(secondLinePos);  
 
-            std::cout << "\t\"testLookUp\":" << testLookUp(tree, numIndicies, file) << "," << std::endl;
+            std::cout << "\t\"testLookUp\":" << testLookUp(tree, numIndicies) << "," << std::endl;
             file.seekg(secondLinePos); 
 
+            std::cout << "\t\"testMultiGet\":" << testMultiGet(tree, numIndicies) << "," << std::endl;
+
             std::cout << "\t\"testLeafChain\":" << testLeafChain(tree) << "," << std::endl;
-            std::cout << "\t\"testRemove\":" << testRemove(tree) << std::endl;
+            std::cout << "\t\"testRangeScan\":" << testRangeScan(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testMappedPages\":" << testMappedPages(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testFreeze\":" << testFreeze(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testSnapshot\":" << testSnapshot(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testSnapshotView\":" << testSnapshotView(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testWriteAheadLog\":" << testWriteAheadLog(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testKeyFile\":" << testKeyFile(numIndicies) << "," << std::endl;
+            std::cout << "\t\"testServer\":" << testServer(tree, numIndicies) << "," << std::endl;
+            std::cout << "\t\"testNodeSearch\":" << testNodeSearch() << "," << std::endl;
+            std::cout << "\t\"testFrozenModel\":" << testFrozenModel(numIndicies) << "," << std::endl;
+            std::cout << "\t\"testStats\":" << testStats(numIndicies) << "," << std::endl;
+            std::cout << "\t\"testAppend\":" << testAppend(numIndicies) << "," << std::endl;
+
+            std::unique_ptr<Tree> batchTree = std::make_unique<Tree>();
+            file.clear();
+            file.seekg(secondLinePos);
+            bool batchPassed = testInsertBatch(batchTree, numIndicies, file, 64);
+            file.seekg(secondLinePos);
+            batchPassed &= testLookUp(batchTree, numIndicies) && testLeafChain(batchTree);
+            std::cout << "\t\"testInsertBatch\":" << batchPassed << "," << std::endl;
+
+            std::unique_ptr<Tree> parallelTree = std::make_unique<Tree>();
+            file.clear();
+            file.seekg(secondLinePos);
+            bool parallelPassed = testBulkLoadParallel(parallelTree, numIndicies, file, 4);
+            file.seekg(secondLinePos);
+            parallelPassed &= testLookUp(parallelTree, numIndicies) && testLeafChain(parallelTree)
+                              && testRangeScan(parallelTree, numIndicies);
+            std::cout << "\t\"testBulkLoadParallel\":" << parallelPassed << "," << std::endl;
+
+            file.clear();
+            file.seekg(secondLinePos);
+            std::cout << "\t\"testConcurrentAccess\":"
+                      << testConcurrentAccess(std::make_unique<ConcurrentBTree<>>(), numIndicies, file, 4) << "," << std::endl;
+            file.clear();
+            file.seekg(secondLinePos);
+            std::cout << "\t\"testShardedTree\":" << testShardedTree(numIndicies, file, 4) << "," << std::endl;
+            std::cout << "\t\"testCompression\":" << testCompression(tree, numIndicies) << "," << std::endl;
+            file.clear();
+            file.seekg(secondLinePos);
+            std::cout << "\t\"testRemove\":" << testRemove(tree, numIndicies, file) << std::endl;
             
         }
     }
     std::cout << "}" << std::endl; 
 }
 
-void runBenchmarks(const std::unique_ptr<BTree> &tree, std::ifstream &file) {
-    std::string line;
-    if (file.is_open()) {
-        if (getline(file, line)) {
-            int numIndicies = std::stoi(line);
-            std::streampos secondLinePos = file.tellg();
+struct BenchmarkResult {
+    std::string name;
+    double insertMs, bulkLoadMs, lookUpMs, leafChainMs, removeMs;
+    size_t height, arenaBytes;
+    bool passed;
+};
+
+/**
+ * Fill tree from keys parsed up front, every key but 0 with the value testInsert gives it.
+ */
+template <typename Tree>
+void insertKeys(const std::unique_ptr<Tree> &tree, const std::vector<uint64_t> &keys) {
+    for (uint64_t key : keys) {
+        if (key) {
+            tree->insert(typename Tree::RecordType {key, valueOf(key)});
+        }
+    }
+}
+
+/**
+ * Time bounded range scans through the cursor API, each covering a fixed share of the keys
+ * starting at random positions.
+ */
+template <typename Tree>
+void benchmarkRangeScans(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::mt19937_64 rng(1);
+    for (double selectivity : {0.001, 0.01, 0.1, 1.0}) {
+        uint64_t width = std::max<uint64_t>(1, numIndicies * selectivity);
+        int scans = std::clamp<int>(1 / selectivity, 1, 1000);
+        uint64_t visited = 0, checksum = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < scans; i++) {
+            uint64_t lo = rng() % (numIndicies - width + 1);
+            for (auto cursor = tree->scan(lo, lo + width - 1); cursor.valid(); cursor.next()) {
+                checksum += cursor.key();
+                visited++;
+            }
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> scan_duration = stop - start;
+        std::cout << "RangeScan benchmark (" << selectivity * 100 << "% of keys) took "
+                  << scan_duration.count() / scans << " milliseconds per scan, "
+                  << scan_duration.count() * 1e6 / std::max<uint64_t>(visited, 1) << " ns per record"
+                  << (checksum ? "" : " (empty)") << ".\n";
+    }
+}
+
+/**
+ * Run the insert, lookup and leaf chain workloads over keys against a fresh tree of type Tree.
+ */
+template <typename Tree>
+BenchmarkResult benchmarkTree(const std::string &name, const std::vector<uint64_t> &keys) {
+    int numIndicies = keys.size();
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    BenchmarkResult result;
+    result.name = name;
+    std::cout << "[" << name << "]\n";
+
+    // Measure time for inserting every key
+    auto start = std::chrono::high_resolution_clock::now();
+    insertKeys(tree, keys);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> insert_duration = stop - start;
+    result.insertMs = insert_duration.count();
+    result.height = tree->height();
+    result.arenaBytes = tree->arena.bytesInUse();
+    std::cout << "Insert benchmark took " << insert_duration.count() << " milliseconds.\n";
+
+    // Measure time to build the same tree with bulkLoad
+    std::vector<typename Tree::RecordType> records;
+    records.reserve(keys.size());
+    for (uint64_t key : keys) {
+        if (key) {
+            records.push_back(typename Tree::RecordType {key, valueOf(key)});
+        }
+    }
+    std::unique_ptr<Tree> bulkTree = std::make_unique<Tree>();
+    start = std::chrono::high_resolution_clock::now();
+    bulkTree->bulkLoad(records.begin(), records.end());
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> bulkload_duration = stop - start;
+    result.bulkLoadMs = bulkload_duration.count();
+    result.passed = bulkTree->capacity == records.size();
+    std::cout << "BulkLoad benchmark took " << bulkload_duration.count() << " milliseconds ("
+              << insert_duration.count() / bulkload_duration.count() << "x faster than inserts).\n";
+    std::cout << "Live nodes hold " << result.arenaBytes << " bytes ("
+              << (double)result.arenaBytes / tree->capacity << " bytes/key, "
+              << sizeof(typename Tree::RecordType::KeyType) + sizeof(typename Tree::RecordType::ValueType)
+              << " bytes per leaf entry), tree height " << result.height << ".\n";
+
+    // Measure time for testLookUp
+    start = std::chrono::high_resolution_clock::now();
+    result.passed &= testLookUp(tree, numIndicies);
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> lookup_duration = stop - start;
+    result.lookUpMs = lookup_duration.count();
+    std::cout << "LookUp benchmark took " << lookup_duration.count() << " milliseconds.\n";
+
+    // Measure time for testLeafChain
+    start = std::chrono::high_resolution_clock::now();
+    result.passed &= testLeafChain(tree);
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> leafchain_duration = stop - start;
+    result.leafChainMs = leafchain_duration.count();
+    std::cout << "LeafChain benchmark took " << leafchain_duration.count() << " milliseconds.\n";
+
+    benchmarkRangeScans(tree, numIndicies);
+
+    // Measure time to remove 90% of the keys in file order, and what the survivors occupy
+    size_t removals = keys.size() * 9 / 10;
+    size_t bytesBefore = tree->arena.bytesInUse();
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < removals; i++) {
+        result.passed &= tree->remove(keys[i]) || keys[i] == 0;
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> remove_duration = stop - start;
+    result.removeMs = remove_duration.count();
+    std::cout << "Remove benchmark took " << remove_duration.count() << " milliseconds for " << removals
+              << " keys (" << removals / remove_duration.count() << " removes/ms).\n";
+    std::cout << "Live nodes hold " << tree->arena.bytesInUse() << " bytes after the removals, "
+              << bytesBefore << " before; tree height " << tree->height() << ".\n";
+    for (size_t i = removals; i < keys.size(); i++) {
+        result.passed &= tree->lookUp(keys[i]).has_value() || keys[i] == 0;
+    }
+    if (!result.passed) {
+        std::cout << "Correctness checks failed for " << name << ".\n";
+    }
+    return result;
+}
+
+/**
+ * Time insertBatch for several batch sizes.
+ */
+template <typename Tree>
+void benchmarkInsertBatch(const std::vector<uint64_t> &keys) {
+    std::vector<typename Tree::RecordType> records(keys.begin(), keys.end());
+
+    for (size_t batchSize : {1, 10, 100, 1000, 10000}) {
+        std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+        std::vector<typename Tree::RecordType> batch(records);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t offset = 0; offset < batch.size(); offset += batchSize) {
+            size_t count = std::min(batchSize, batch.size() - offset);
+            tree->insertBatch(std::span(batch.data() + offset, count));
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> batch_duration = stop - start;
+        std::cout << "InsertBatch benchmark (batch " << batchSize << ") took " << batch_duration.count()
+                  << " milliseconds, " << records.size() / batch_duration.count() << " inserts/ms.\n";
+    }
+}
+
+/**
+ * Time writing a filled tree to a page file, opening it mapped and serving lookups from the
+ * mapping, next to lookups on the in memory tree.
+ */
+template <typename Tree>
+void benchmarkPageFile(const std::vector<uint64_t> &keys) {
+    int numIndicies = keys.size();
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+    std::string path = (std::filesystem::temp_directory_path() / "btree-bench.pages").string();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tree->writePages(path);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> write_duration = stop - start;
+    std::cout << "WritePages benchmark took " << write_duration.count() << " milliseconds ("
+              << std::filesystem::file_size(path) << " bytes).\n";
+
+    start = std::chrono::high_resolution_clock::now();
+    auto mapped = Tree::openMapped(path);
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> open_duration = stop - start;
+    std::cout << "OpenMapped benchmark took " << open_duration.count() << " milliseconds.\n";
+
+    uint64_t found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 1; i < numIndicies; i++) {
+        found += mapped.lookUp(i).has_value();
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> lookup_duration = stop - start;
+    std::cout << "Mapped LookUp benchmark took " << lookup_duration.count() << " milliseconds"
+              << (found == (uint64_t)numIndicies - 1 ? "" : " [FAILED]") << ".\n";
+    std::filesystem::remove(path);
+}
+
+/**
+ * Time a snapshot round trip of a filled tree through a file, reported as throughput so it
+ * can be held against the disk bandwidth.
+ */
+template <typename Tree>
+void benchmarkSnapshot(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+    std::string path = (std::filesystem::temp_directory_path() / "btree-bench.snapshot").string();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        tree->save(out);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> save_duration = stop - start;
+    double megabytes = std::filesystem::file_size(path) / 1e6;
+    std::cout << "Save benchmark took " << save_duration.count() << " milliseconds ("
+              << megabytes * 1000 / save_duration.count() << " MB/s).\n";
+
+    std::unique_ptr<Tree> loaded = std::make_unique<Tree>();
+    start = std::chrono::high_resolution_clock::now();
+    {
+        std::ifstream in(path, std::ios::binary);
+        loaded->load(in);
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> load_duration = stop - start;
+    std::cout << "Load benchmark took " << load_duration.count() << " milliseconds ("
+              << megabytes * 1000 / load_duration.count() << " MB/s)"
+              << (loaded->capacity == tree->capacity ? "" : " [FAILED]") << ".\n";
+    std::filesystem::remove(path);
+}
+
+/**
+ * Time acknowledged logged inserts: several writers each append a key, wait until the log has
+ * it on disk and only then apply it, as a server answering clients would. A group closes once
+ * every writer has a record in it, so one sync acknowledges up to one insert per writer.
+ */
+template <typename Tree>
+void benchmarkWriteAheadLog(const std::vector<uint64_t> &keys) {
+    std::string path = (std::filesystem::temp_directory_path() / "btree-bench.wal").string();
+
+    for (size_t writers : {1, 4, 16, 64}) {
+        // every insert waits for a sync, so a slice of the keys gives the rate
+        size_t count = std::min<size_t>(keys.size(), 2000 * writers);
+        std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+        std::mutex treeMutex;
+        std::filesystem::remove(path);
+        auto start = std::chrono::high_resolution_clock::now();
+        {
+            WriteAheadLog<> wal(path, GroupCommit {writers, std::chrono::milliseconds(5)});
+            std::vector<std::thread> threads;
+            for (size_t w = 0; w < writers; w++) {
+                threads.emplace_back([&, w] {
+                    for (size_t i = w; i < count; i += writers) {
+                        wal.waitDurable(wal.append(WalOp::Insert, keys[i]));
+                        std::lock_guard<std::mutex> lock(treeMutex);
+                        tree->insert(keys[i]);
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> wal_duration = stop - start;
+        std::cout << "Logged insert benchmark (writers " << writers << ") took " << wal_duration.count() * 1000
+                  << " milliseconds for " << count << " durable keys, " << count / wal_duration.count() << " inserts/s.\n";
+    }
+    std::filesystem::remove(path);
+}
+
+/**
+ * Time lookups on one filled tree once per node search path the cpu supports.
+ */
+template <typename Tree>
+void benchmarkSearchPaths(const std::vector<uint64_t> &keys) {
+    int numIndicies = keys.size();
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+
+    SearchPath original = activeSearchPath();
+    for (SearchPath path : {SearchPath::Scalar, SearchPath::SSE42, SearchPath::AVX2, SearchPath::AVX512}) {
+        if (!setSearchPath(path)) {
+            continue;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        bool passed = testLookUp(tree, numIndicies);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> lookup_duration = stop - start;
+        std::cout << "LookUp benchmark (" << searchPathName(path) << ") took " << lookup_duration.count()
+                  << " milliseconds, " << lookup_duration.count() / numIndicies << " ms/lookup"
+                  << (passed ? "" : " [FAILED]") << ".\n";
+    }
+    setSearchPath(original);
+}
+
+/**
+ * Look every key of the file up in file order, once one lookUp at a time and once through
+ * multiGet, on the same filled tree.
+ */
+template <typename Tree>
+void benchmarkMultiGet(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+
+    std::vector<std::optional<uint64_t>> scalar(keys.size()), batched(keys.size());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        scalar[i] = tree->lookUp(keys[i]);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> scalar_duration = stop - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    tree->multiGet(keys, batched);
+    stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> batched_duration = stop - start;
+    std::cout << "LookUp loop took " << scalar_duration.count() << " milliseconds, multiGet "
+              << batched_duration.count() << " milliseconds (" << scalar_duration.count() / batched_duration.count()
+              << "x), tree height " << tree->height() << (scalar == batched ? "" : " [FAILED]") << ".\n";
+}
+
+/**
+ * Freeze a filled tree and compare the frozen copy with it: memory, every key looked up in
+ * file order one at a time and through multiGet, and a full range scan. The frozen copy runs
+ * once through the fences alone and once with its learned model, whose fit is reported.
+ */
+template <typename Tree>
+void benchmarkFreeze(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+    auto start = std::chrono::high_resolution_clock::now();
+    auto frozen = tree->freeze();
+    std::chrono::duration<double, std::milli> freeze_duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Freeze took " << freeze_duration.count() << " milliseconds.\n";
+
+    auto measure = [&](const std::string &label, auto &target, size_t bytes) {
+        std::vector<std::optional<uint64_t>> scalar(keys.size()), batched(keys.size());
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            scalar[i] = target.lookUp(keys[i]);
+        }
+        auto middle = std::chrono::high_resolution_clock::now();
+        target.multiGet(keys, batched);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> scalar_duration = middle - start, batched_duration = stop - middle;
+
+        uint64_t checksum = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (auto cursor = target.scan(0, UINT64_MAX); cursor.valid(); cursor.next()) {
+            checksum += cursor.key() ^ cursor.value();
+        }
+        stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> scan_duration = stop - start;
+        size_t found = std::count_if(scalar.begin(), scalar.end(), [](auto &value) { return value.has_value(); });
+        bool passed = scalar == batched && found == tree->capacity;
+        std::cout << label << ": " << bytes << " bytes (" << (double)bytes / keys.size() << " bytes/key), LookUp took "
+                  << scalar_duration.count() << " milliseconds, multiGet " << batched_duration.count()
+                  << " milliseconds, full range scan " << scan_duration.count() << " milliseconds"
+                  << (passed && checksum ? "" : " [FAILED]") << ".\n";
+        return std::make_pair(scalar_duration.count(), batched_duration.count());
+    };
+    measure("Mutable tree", *tree, tree->arena.bytesInUse());
+    frozen.useModel(false);
+    auto fences = measure("Frozen tree, fences", frozen, frozen.bytesInUse());
+    frozen.useModel(true);
+    auto model = measure("Frozen tree, learned model", frozen, frozen.bytesInUse());
+
+    FrozenModelStats stats = frozen.modelStats();
+    std::cout << "Learned model: " << stats.fitted << " of " << stats.segments << " segments fitted, covering "
+              << (double)stats.records / std::max<size_t>(frozen.capacity, 1) * 100 << "% of the records, error "
+              << stats.meanError << " on average and " << stats.maxError << " at most, LookUp "
+              << fences.first / model.first << "x and multiGet " << fences.second / model.second << "x the fences.\n";
+}
+
+/**
+ * Look every key up through the socket server, one round trip per request and pipelined in
+ * windows of several sizes, next to what parsing the same requests as interactive mode JSON
+ * costs on its own.
+ */
+template <typename Tree>
+void benchmarkServer(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+    std::string path = (std::filesystem::temp_directory_path() / "btree-bench.sock").string();
+    TreeServer<Tree> server(*tree);
+    server.listenUnix(path);
+    std::thread serving([&] { server.run(); });
+
+    TreeClient client(path);
+    for (size_t window : {1, 16, 256, 4096}) {
+        // a round trip per key is slow enough that a slice of the keys gives the rate
+        size_t count = window == 1 ? std::min<size_t>(keys.size(), 20000) : keys.size();
+        uint64_t found = 0, expected = count - std::count(keys.begin(), keys.begin() + count, 0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t first = 0; first < count; first += window) {
+            size_t last = std::min(first + window, count);
+            for (size_t i = first; i < last; i++) {
+                client.lookUp(keys[i]);
+            }
+            client.flush();
+            for (size_t i = first; i < last; i++) {
+                found += client.next().status == ServerStatus::Ok;
+            }
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = stop - start;
+        std::cout << "Socket LookUp (pipeline " << window << ") took " << duration.count() * 1000 << " milliseconds for "
+                  << count << " keys, " << count / duration.count() << " lookups/s"
+                  << (found == expected ? "" : " [FAILED]") << ".\n";
+    }
+    server.stop();
+    serving.join();
+
+    uint64_t parsed = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t key : keys) {
+        parsed += json::parse("{\"insert\": " + std::to_string(key) + "}")["insert"].template get<uint64_t>();
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = stop - start;
+    std::cout << "JSON parsing alone of the same requests took " << duration.count() * 1000 << " milliseconds, "
+              << keys.size() / duration.count() << " requests/s" << (parsed ? "" : " [FAILED]") << ".\n";
+}
+
+/**
+ * What copy on write costs the writer: updates to every key with no view, under one view
+ * taken up front (each leaf copied once) and with a new view every 1000 updates, plus a full
+ * scan of a view against the live leaf chain.
+ */
+template <typename Tree>
+void benchmarkSnapshotViews(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+
+    for (uint64_t key : keys) {
+        tree->update(key, valueOf(key)); // warm up, so the first measured pass is not the coldest
+    }
+    size_t baseline = tree->arena.bytesInUse();
+    uint64_t present = *std::find_if(keys.begin(), keys.end(), [](uint64_t key) { return key != 0; });
 
+    auto updateAll = [&](const std::string &label, size_t viewEvery) {
+        std::optional<decltype(tree->snapshot())> view;
+        size_t peak = baseline;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (viewEvery && i % viewEvery == 0) {
+                view.reset(); // released before the next one is taken, so replaced nodes can go
+                view.emplace(tree->snapshot());
+            }
+            if (i % 1000 == 0) {
+                peak = std::max(peak, tree->arena.bytesInUse());
+            }
+            tree->update(keys[i], valueOf(keys[i]));
+        }
+        std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+        peak = std::max(peak, tree->arena.bytesInUse());
+        view.reset();
+        tree->update(present, valueOf(present)); // frees what the last view held on to
+        std::cout << label << ": updates took " << duration.count() << " milliseconds, "
+                  << (double)(peak - baseline) / baseline * 100 << "% extra memory at most.\n";
+    };
+    updateAll("No view", 0);
+    updateAll("One view", keys.size());
+    updateAll("View every 1000 updates", 1000);
+
+    auto view = tree->snapshot();
+    uint64_t viewChecksum = 0, liveChecksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto cursor = view.scan(0, UINT64_MAX); cursor.valid(); cursor.next()) {
+        viewChecksum += cursor.key() ^ cursor.value();
+    }
+    auto middle = std::chrono::high_resolution_clock::now();
+    for (auto cursor = tree->scan(0, UINT64_MAX); cursor.valid(); cursor.next()) {
+        liveChecksum += cursor.key() ^ cursor.value();
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> viewScan = middle - start, liveScan = stop - middle;
+    std::cout << "Full scan of a view took " << viewScan.count() << " milliseconds, of the tree "
+              << liveScan.count() << " milliseconds" << (viewChecksum == liveChecksum ? "" : " [FAILED]") << ".\n";
+}
+
+/**
+ * Insert the keys of the file one by one in file order and again in ascending order, where
+ * every insert is an append to the rightmost leaf, and report throughput and leaf fill.
+ */
+template <typename Tree>
+void benchmarkAppends(const std::vector<uint64_t> &keys) {
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    auto measure = [&](const std::string &label, const std::vector<uint64_t> &order) {
+        std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+        auto start = std::chrono::high_resolution_clock::now();
+        insertKeys(tree, order);
+        std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+        TreeStats stats = tree->stats();
+        std::cout << label << ": " << duration.count() << " milliseconds (" << tree->capacity / duration.count() / 1000
+                  << " Mops/s), " << stats.leaves << " leaves " << stats.leafFill * 100 << "% full, "
+                  << stats.bytesInUse << " bytes.\n";
+    };
+    measure("Random order", keys);
+    measure("Ascending order", sorted);
+}
+
+/**
+ * Memory, lookups and a full range scan of one filled tree before and after compress().
+ */
+template <typename Tree>
+void benchmarkCompression(const std::vector<uint64_t> &keys) {
+    int numIndicies = keys.size();
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    insertKeys(tree, keys);
+
+    auto measure = [&](const std::string &label) {
+        auto start = std::chrono::high_resolution_clock::now();
+        bool passed = testLookUp(tree, numIndicies);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> lookup_duration = stop - start;
+
+        uint64_t checksum = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (auto cursor = tree->scan(0, UINT64_MAX); cursor.valid(); cursor.next()) {
+            checksum += cursor.key() ^ cursor.value();
+        }
+        stop = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> scan_duration = stop - start;
+        std::cout << label << ": " << tree->arena.bytesInUse() << " bytes ("
+                  << (double)tree->arena.bytesInUse() / tree->capacity << " bytes/key), LookUp took "
+                  << lookup_duration.count() << " milliseconds, full range scan "
+                  << scan_duration.count() << " milliseconds" << (passed && checksum ? "" : " [FAILED]") << ".\n";
+    };
+
+    measure("Plain leaves");
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t packed = tree->compress();
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> compress_duration = stop - start;
+    std::cout << "Compress took " << compress_duration.count() << " milliseconds, " << packed << " of "
+              << tree->stats().leaves << " leaves packed.\n";
+    measure("Packed leaves");
+}
+
+inline uint64_t statCount(const StatCounts &counts, Stat stat) {
+    return counts[static_cast<size_t>(stat)];
+}
+
+/**
+ * Insert the keys of the file in ten slices and report per slice what an insert cost and
+ * what it did: splits, pushUp cascades, nodes visited and, where the kernel allows it, cache
+ * and branch misses. Then the same for looking every key up, and the final tree shape.
+ */
+template <typename Tree>
+void benchmarkStats(const std::vector<uint64_t> &keys) {
+    if (!statsEnabled) {
+        std::cout << "Operation counters are compiled out, rebuild with make clean && make STATS=1 to see them.\n";
+    }
+    HardwareCounters hardware;
+    if (!hardware.available()) {
+        std::cout << "Hardware counters are not available (perf_event_open refused).\n";
+    }
+
+    auto report = [&](const std::string &label, size_t ops, double ms, Tree &tree) {
+        StatCounts counts = StatsRegistry::instance().aggregate();
+        HardwareCounts hw = hardware.read();
+        std::cout << label << " (height " << tree.height() << "): " << ms * 1e6 / ops << " ns";
+        if (statsEnabled) {
+            std::cout << ", " << (double)statCount(counts, Stat::NodesVisited) / ops << " nodes visited, "
+                      << (double)statCount(counts, Stat::LeafSplits) / ops << " leaf splits, "
+                      << (double)statCount(counts, Stat::PushUpCascades) / ops << " pushUp cascades";
+        }
+        if (hardware.available()) {
+            std::cout << ", " << (double)hw.cacheMisses / ops << " cache misses, "
+                      << (double)hw.branchMisses / ops << " branch misses, "
+                      << (double)hw.instructions / std::max<uint64_t>(hw.cycles, 1) << " IPC";
+        }
+        std::cout << " per op.\n";
+    };
+
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    size_t slices = std::min<size_t>(10, keys.size());
+    for (size_t slice = 0; slice < slices; slice++) {
+        size_t begin = keys.size() * slice / slices, end = keys.size() * (slice + 1) / slices;
+        StatsRegistry::instance().reset();
+        hardware.reset();
+        hardware.start();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = begin; i < end; i++) {
+            tree->insert(keys[i]);
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        hardware.stop();
+        std::chrono::duration<double, std::milli> insert_duration = stop - start;
+        report("Insert up to " + std::to_string(end) + " keys", end - begin, insert_duration.count(), *tree);
+    }
+
+    StatsRegistry::instance().reset();
+    hardware.reset();
+    uint64_t found = 0;
+    hardware.start();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t key : keys) {
+        found += tree->lookUp(key).has_value();
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    hardware.stop();
+    std::chrono::duration<double, std::milli> lookup_duration = stop - start;
+    report(std::string("LookUp") + (found == keys.size() ? "" : " [FAILED]"), keys.size(), lookup_duration.count(), *tree);
+
+    TreeStats stats = tree->stats();
+    std::cout << "Tree shape: " << stats.leaves << " leaves " << stats.leafFill * 100 << "% full, "
+              << stats.internalNodes << " internal nodes " << stats.internalFill * 100 << "% full, "
+              << stats.bytesInUse << " bytes in live nodes, " << stats.bytesReserved << " in arena slabs.\n";
+}
+
+/**
+ * Parse the key file once, timed on its own, and run every benchmark over the parsed keys so
+ * none of them measures parsing.
+ */
+void runBenchmarks(const std::string &path, bool stats) {
+    unsigned parseThreads = std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint64_t> keys = readKeyFile(path, parseThreads);
+    std::chrono::duration<double, std::milli> parse_duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Parsed " << keys.size() << " keys in " << parse_duration.count() << " milliseconds ("
+              << std::filesystem::file_size(path) / parse_duration.count() / 1000 << " MB/s, "
+              << parseThreads << " threads).\n";
+    std::vector<BenchmarkResult> results;
+    results.push_back(benchmarkTree<BTree<uint64_t, uint64_t, 5, 3>>("leaf 5, inner 3", keys));
+    results.push_back(benchmarkTree<BTree<uint64_t, uint64_t, 64, 64>>("leaf 64, inner 64", keys));
+    results.push_back(benchmarkTree<BTree<uint64_t, uint64_t, 128, 128>>("leaf 128, inner 128", keys));
+    results.push_back(benchmarkTree<BTree<uint64_t, uint64_t, 256, 256>>("leaf 256, inner 256", keys));
+    results.push_back(benchmarkTree<BTree<>>("page sized (default)", keys));
+
+    auto best = std::min_element(results.begin(), results.end(),
+        [](const BenchmarkResult& lhs, const BenchmarkResult& rhs) {
+            return lhs.insertMs + lhs.lookUpMs < rhs.insertMs + rhs.lookUpMs;
+        });
+    std::cout << "Best configuration: " << best->name << " (" << best->insertMs + best->lookUpMs
+              << " milliseconds insert + lookup).\n";
+
+    std::cout << "[node search paths, " << searchPathName(activeSearchPath()) << " by default]\n";
+    benchmarkSearchPaths<BTree<>>(keys);
+
+    std::cout << "[multiGet, groups of " << MULTIGET_GROUP << "]\n";
+    benchmarkMultiGet<BTree<>>(keys);
+
+    std::cout << "[page file]\n";
+    benchmarkPageFile<BTree<>>(keys);
+
+    std::cout << "[frozen layout, blocks of " << FROZEN_BLOCK << "]\n";
+    benchmarkFreeze<BTree<>>(keys);
+
+    std::cout << "[snapshot]\n";
+    benchmarkSnapshot<BTree<>>(keys);
+
+    std::cout << "[snapshot views]\n";
+    benchmarkSnapshotViews<BTree<>>(keys);
+
+    std::cout << "[write-ahead log]\n";
+    benchmarkWriteAheadLog<BTree<>>(keys);
+
+    std::cout << "[socket server]\n";
+    benchmarkServer<BTree<>>(keys);
+
+    std::cout << "[sequential appends]\n";
+    benchmarkAppends<BTree<>>(keys);
+
+    std::cout << "[batched inserts]\n";
+    benchmarkInsertBatch<BTree<>>(keys);
 
-            // Measure time for testInsert
+    std::cout << "[compressed leaves]\n";
+    benchmarkCompression<BTree<>>(keys);
+
+    if (stats) {
+        std::cout << "[stats]\n";
+        benchmarkStats<BTree<>>(keys);
+    }
+}
+
+/**
+ * Insert and then look up every key of the file from 1, 2, 4, ... up to maxThreads threads
+ * against a ConcurrentBTree and report throughput relative to a single thread. With stats,
+ * also how often optimistic descents had to restart.
+ */
+void runConcurrentBenchmarks(const std::string &path, int maxThreads, bool stats) {
+    std::vector<uint64_t> keys = readKeyFile(path, maxThreads);
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    double baseInsert = 0, baseLookUp = 0;
+    for (int threads : threadCounts) {
+        std::unique_ptr<ConcurrentBTree<>> tree = std::make_unique<ConcurrentBTree<>>();
+        std::atomic<uint64_t> found(0);
+        StatsRegistry::instance().reset();
+
+        auto runThreads = [&](auto &&work) {
+            std::vector<std::thread> workers;
             auto start = std::chrono::high_resolution_clock::now();
-            testInsert(tree, numIndicies, file);
-            auto stop = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double, std::milli> insert_duration = stop - start;
-            std::cout << "Insert benchmark took " << insert_duration.count() << " milliseconds.\n";
-            file.seekg(secondLinePos);
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    for (size_t i = t; i < keys.size(); i += threads) {
+                        work(keys[i]);
+                    }
+                });
+            }
+            for (auto &worker : workers) {
+                worker.join();
+            }
+            std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+            return keys.size() / duration.count() / 1000; // million operations per second
+        };
+
+        double insertMops = runThreads([&](uint64_t key) { tree->insert(key); });
+        double lookUpMops = runThreads([&](uint64_t key) {
+            if (tree->lookUp(key).has_value()) {
+                found.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        if (threads == 1) {
+            baseInsert = insertMops;
+            baseLookUp = lookUpMops;
+        }
+        std::cout << threads << " threads: insert " << insertMops << " Mops/s (" << insertMops / baseInsert
+                  << "x), lookup " << lookUpMops << " Mops/s (" << lookUpMops / baseLookUp << "x)"
+                  << (found == keys.size() ? "" : " [MISSING KEYS]") << ".\n";
+        if (stats && statsEnabled) {
+            StatCounts counts = StatsRegistry::instance().aggregate();
+            std::cout << "  " << (double)statCount(counts, Stat::Restarts) / (2 * keys.size())
+                      << " restarts per operation.\n";
+        }
 
-            // Measure time for testLookUp
-            // start = std::chrono::high_resolution_clock::now();
-            // testLookUp(tree, numIndicies, file);
-            // stop = std::chrono::high_resolution_clock::now();
-            // std::chrono::duration<double, std::milli> lookup_duration = stop - start;
-            // std::cout << "LookUp benchmark took " << lookup_duration.count() << " milliseconds.\n";
-            // file.seekg(secondLinePos);
+        // the same workload on one shard per thread, inserts counted once sync() has applied them
+        ShardOptions options;
+        options.shards = threads;
+        ShardedBTree<> sharded(options);
+        found = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        runThreads([&](uint64_t key) { sharded.insert(key); });
+        sharded.sync();
+        std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+        double shardedInsertMops = keys.size() / duration.count() / 1000;
+        double shardedLookUpMops = runThreads([&](uint64_t key) {
+            if (sharded.lookUp(key).has_value()) {
+                found.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        uint64_t largest = 0;
+        for (const ShardStats &shard : sharded.stats()) {
+            largest = std::max(largest, shard.records);
+        }
+        std::cout << "  sharded: insert " << shardedInsertMops << " Mops/s, lookup " << shardedLookUpMops
+                  << " Mops/s" << (found == keys.size() ? "" : " [MISSING KEYS]") << ", largest shard "
+                  << largest * threads / (double)keys.size() << "x the mean.\n";
+    }
+}
 
-            // Measure time for testLeafChain
-            start = std::chrono::high_resolution_clock::now();
-            testLeafChain(tree);
-            stop = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double, std::milli> leafchain_duration = stop - start;
-            std::cout << "LeafChain benchmark took " << leafchain_duration.count() << " milliseconds.\n";
- 
-            testRemove(tree); 
+/**
+ * Build the tree from the key file with bulkLoadParallel on 1, 2, 4, ... up to maxThreads
+ * threads, timing parse, sort and leaf packing separately, and compare the total against
+ * parsing on one thread and inserting key by key.
+ */
+void runParallelBuild(const std::string &path, unsigned maxThreads) {
+    typedef BTree<> Tree;
+    std::unique_ptr<Tree> serialTree = std::make_unique<Tree>();
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint64_t> serialKeys = readKeyFile(path, 1);
+    auto parsed = std::chrono::high_resolution_clock::now();
+    insertKeys(serialTree, serialKeys);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> serialParseMs = parsed - start, serialInsertMs = stop - parsed,
+                                              serialMs = stop - start;
+    std::cout << "Serial parse " << serialParseMs.count() << " ms, insert " << serialInsertMs.count()
+              << " ms, total " << serialMs.count() << " ms.\n";
+    int numIndicies = serialKeys.size();
+    bool passed = testLookUp(serialTree, numIndicies);
+    serialTree.reset();
+    serialKeys = {};
+
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    double baseMs = 0;
+    for (unsigned threads : threadCounts) {
+        std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+        start = std::chrono::high_resolution_clock::now();
+        std::vector<uint64_t> keys = readKeyFile(path, threads);
+        std::vector<Tree::RecordType> records;
+        records.reserve(keys.size());
+        for (uint64_t key : keys) {
+            if (key) {
+                records.push_back(Tree::RecordType {key, valueOf(key)});
+            }
+        }
+        keys = {};
+        parsed = std::chrono::high_resolution_clock::now();
+        parallelSort(records, threads);
+        auto sorted = std::chrono::high_resolution_clock::now();
+        tree->bulkLoadParallel(records, threads);
+        stop = std::chrono::high_resolution_clock::now();
+
+        std::chrono::duration<double, std::milli> parseMs = parsed - start, sortMs = sorted - parsed,
+                                                  packMs = stop - sorted, totalMs = stop - start;
+        if (threads == 1) {
+            baseMs = totalMs.count();
         }
+        passed &= testLookUp(tree, numIndicies) && testLeafChain(tree);
+        std::cout << threads << " threads: parse " << parseMs.count() << " ms, sort " << sortMs.count()
+                  << " ms, pack " << packMs.count() << " ms, total " << totalMs.count() << " ms ("
+                  << baseMs / totalMs.count() << "x one thread, " << serialMs.count() / totalMs.count()
+                  << "x serial).\n";
+    }
+    if (!passed) {
+        std::cout << "Correctness checks failed.\n";
+    }
+}
+
+struct InteractiveOptions {
+    std::string snapshotPath, walPath;
+    GroupCommit groupCommit;
+    int tcpPort = -1; // server mode only, -1 for none
+};
+
+/**
+ * Load the snapshot and replay the log named in options into tree. Returns the log opened for
+ * further appends, or nullptr without one. Throws when either can not be read.
+ */
+template <typename Tree>
+std::unique_ptr<WriteAheadLog<>> recover(const std::unique_ptr<Tree> &tree, const InteractiveOptions &options) {
+    if (!options.snapshotPath.empty() && std::filesystem::exists(options.snapshotPath)) {
+        std::ifstream in(options.snapshotPath, std::ios::binary);
+        tree->load(in);
+    }
+    if (options.walPath.empty()) {
+        return nullptr;
+    }
+    auto wal = std::make_unique<WriteAheadLog<>>(options.walPath, options.groupCommit);
+    wal->replay([&](WalOp op, uint64_t key, uint64_t value) {
+        if (op == WalOp::Insert) {
+            tree->insert(typename Tree::RecordType {key, value});
+        } else {
+            tree->remove(key);
+        }
+    });
+    return wal;
+}
+
+/**
+ * Save the tree to snapshotPath without ever leaving a partial snapshot behind, then drop
+ * the log records it covers.
+ */
+template <typename Tree>
+void checkpoint(const std::unique_ptr<Tree> &tree, const std::string &snapshotPath, WriteAheadLog<> *wal) {
+    std::string tempPath = snapshotPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        tree->save(out);
+    }
+    syncPath(tempPath);
+    std::filesystem::rename(tempPath, snapshotPath);
+    if (wal) {
+        wal->truncate();
     }
 }
 
@@ -87,10 +1019,33 @@ void runBenchmarks(const std::unique_ptr<BTree> &tree, std::ifstream &file) {
 using json = nlohmann::json;
 
 
-void handleInteractiveMode(const std::unique_ptr<BTree> &tree) {
+template <typename Tree>
+void handleInteractiveMode(const std::unique_ptr<Tree> &tree, const InteractiveOptions &options) {
     json msg;
     std::string line;
 
+    std::unique_ptr<WriteAheadLog<>> wal;
+    std::unique_ptr<HardwareCounters> hardware;
+    if (statsEnabled) {
+        hardware = std::make_unique<HardwareCounters>();
+    }
+    auto measured = [&](auto &&mutate) {
+        if (hardware) {
+            hardware->start();
+        }
+        mutate();
+        if (hardware) {
+            hardware->stop();
+        }
+    };
+
+    try {
+        wal = recover(tree, options);
+    } catch (const std::exception& e) {
+        std::cout << json {{"error", e.what()}}.dump() << std::endl;
+        return;
+    }
+
     while (std::getline(std::cin, line)) {
         auto result = json::parse(line, nullptr, false);
         if (result.is_discarded()) {
@@ -98,13 +1053,69 @@ void handleInteractiveMode(const std::unique_ptr<BTree> &tree) {
             continue;  // Skip the rest of the loop and wait for next input
         } else {
             msg = result;
-            if (msg.contains("insert")) {
-                int value = msg["insert"];
-                tree->insert(value); 
+            bool keysValid = (!msg.contains("insert") || msg["insert"].is_number_unsigned())
+                             && (!msg.contains("remove") || msg["remove"].is_number_unsigned())
+                             && (!msg.contains("insert_batch") || (msg["insert_batch"].is_array()
+                                 && std::all_of(msg["insert_batch"].begin(), msg["insert_batch"].end(),
+                                                [](const json &key) { return key.is_number_unsigned(); })));
+            if (!keysValid) {
+                std::cout << "{\"error\": \"keys must be unsigned integers\"}" << std::endl;
+            } else if (msg.contains("insert")) {
+                uint64_t value = msg["insert"];
+                if (wal) {
+                    wal->append(WalOp::Insert, value);
+                }
+                measured([&] { tree->insert(value); });
+            } else if (msg.contains("insert_batch")) {
+                std::vector<typename Tree::RecordType> batch;
+                for (uint64_t value : msg["insert_batch"]) {
+                    batch.push_back(value);
+                    if (wal) {
+                        wal->append(WalOp::Insert, value);
+                    }
+                }
+                measured([&] { tree->insertBatch(batch); });
+            } else if (msg.contains("remove")) {
+                uint64_t value = msg["remove"];
+                if (wal) {
+                    wal->append(WalOp::Remove, value);
+                }
+                measured([&] { tree->remove(value); });
             } else if (msg.contains("command")) {
-                std::string command = msg["command"];
+                std::string command = msg["command"].is_string() ? msg["command"].get<std::string>() : "";
                 if (command == "json_state") {
                     std::cout << serialize(tree) << std::endl;
+                } else if (command == "stats") {
+                    std::cout << serializeStats(tree->stats(), hardware.get()) << std::endl;
+                } else if (command == "compress") {
+                    std::cout << json {{"packed_leaves", tree->compress()}, {"bytes_in_use", tree->arena.bytesInUse()}}.dump() << std::endl;
+                } else if ((command == "save" || command == "load") && msg.contains("path")) {
+                    std::string path = msg["path"];
+                    try {
+                        if (command == "save") {
+                            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                            tree->save(out);
+                        } else {
+                            std::ifstream in(path, std::ios::binary);
+                            tree->load(in);
+                        }
+                        std::cout << "{\"ok\": true}" << std::endl;
+                    } catch (const std::exception& e) {
+                        std::cout << json {{"error", e.what()}}.dump() << std::endl;
+                    }
+                } else if (command == "checkpoint" && !options.snapshotPath.empty()) {
+                    try {
+                        checkpoint(tree, options.snapshotPath, wal.get());
+                        std::cout << "{\"ok\": true}" << std::endl;
+                    } catch (const std::exception& e) {
+                        std::cout << json {{"error", e.what()}}.dump() << std::endl;
+                    }
+                } else if (command == "save" || command == "load") {
+                    std::cout << "{\"error\": \"" << command << " needs a path\"}" << std::endl;
+                } else if (command == "checkpoint") {
+                    std::cout << "{\"error\": \"checkpoint needs --snapshot\"}" << std::endl;
+                } else {
+                    std::cout << "{\"error\": \"unknown command\"}" << std::endl;
                 }
             } else {
                 std::cout << "{\"error\": \"unrecognized command\"}" << std::endl;
@@ -114,25 +1125,141 @@ void handleInteractiveMode(const std::unique_ptr<BTree> &tree) {
     }
 }
 
+template <typename Server>
+Server *signalledServer = nullptr;
+
+template <typename Server>
+void stopOnSignal(int) {
+    signalledServer<Server>->stop();
+}
+
+/**
+ * Start program in server mode with -s: serve the binary protocol of server.h on socketPath
+ * and the TCP port of options until SIGINT or SIGTERM.
+ */
+template <typename Tree>
+int handleServerMode(const std::unique_ptr<Tree> &tree, const std::string &socketPath, const InteractiveOptions &options) {
+    typedef TreeServer<Tree> Server;
+    try {
+        std::unique_ptr<WriteAheadLog<>> wal = recover(tree, options);
+        Server server(*tree, wal.get());
+        server.listenUnix(socketPath);
+        json listening = {{"listening", socketPath}};
+        if (options.tcpPort >= 0) {
+            listening["tcp_port"] = server.listenTcp(options.tcpPort);
+        }
+        std::cout << listening.dump() << std::endl;
+
+        signalledServer<Server> = &server;
+        std::signal(SIGINT, stopOnSignal<Server>);
+        std::signal(SIGTERM, stopOnSignal<Server>);
+        server.run();
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        signalledServer<Server> = nullptr;
+        if (wal) {
+            wal->sync();
+        }
+    } catch (const std::exception& e) {
+        std::cout << json {{"error", e.what()}}.dump() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Options shared by the interactive and server modes from argv[first] on, false on an unknown
+ * or incomplete one.
+ */
+bool parseInteractiveOptions(int argc, char **argv, int first, InteractiveOptions &options) {
+    if ((argc - first) % 2 != 0) {
+        return false;
+    }
+    for (int i = first; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--snapshot") {
+            options.snapshotPath = argv[i + 1];
+        } else if (option == "--wal") {
+            options.walPath = argv[i + 1];
+        } else if (option == "--group-commit") {
+            options.groupCommit.maxRecords = std::max(1, std::stoi(argv[i + 1]));
+        } else if (option == "--group-window-ms") {
+            options.groupCommit.window = std::chrono::milliseconds(std::stoi(argv[i + 1]));
+        } else if (option == "--tcp") {
+            options.tcpPort = std::stoi(argv[i + 1]);
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     
-    std::unique_ptr<BTree> tree = std::make_unique<BTree>(); 
+    std::unique_ptr<BTree<>> tree = std::make_unique<BTree<>>(); 
      
     if (argc >= 2) {
         std::string flag = argv[1];
         
         if (flag == "-i") {
-            handleInteractiveMode(tree); 
+            InteractiveOptions options;
+            if (!parseInteractiveOptions(argc, argv, 2, options) || options.tcpPort >= 0) {
+                std::cerr << helpMessage;
+                return 1;
+            }
+            handleInteractiveMode(tree, options); 
+        } else if (flag == "-s" && argc >= 3) {
+            InteractiveOptions options;
+            if (!parseInteractiveOptions(argc, argv, 3, options)) {
+                std::cerr << helpMessage;
+                return 1;
+            }
+            return handleServerMode(tree, argv[2], options);
         } else if (flag == "-h") {
             std::cerr << helpMessage;
         } else if (flag == "-t" && argc == 3) { 
             std::string file_name = argv[2];
             std::ifstream file(file_name);
             handleTests(tree, file);
-        }  else if (flag == "-b" && argc == 3) {
+        } else if (flag == "-l" && (argc == 3 || argc == 4)) {
             std::string file_name = argv[2];
             std::ifstream file(file_name);
-            runBenchmarks(tree, file);
+            double fillFactor = argc == 4 ? std::stod(argv[3]) : 1.0;
+            handleBulkLoadTests(tree, file, fillFactor);
+        }  else if (flag == "-b" && argc >= 3) {
+            std::string file_name = argv[2];
+            int threads = -1;
+            bool stats = false;
+            for (int i = 3; i < argc; i++) {
+                std::string option = argv[i];
+                if (option == "--threads" && i + 1 < argc) {
+                    threads = std::stoi(argv[++i]);
+                } else if (option == "--stats") {
+                    stats = true;
+                } else {
+                    std::cerr << "Unknown option: " << option << std::endl;
+                    return 1;
+                }
+            }
+            try {
+                if (threads >= 0) {
+                    runConcurrentBenchmarks(file_name, threads > 0 ? threads : std::thread::hardware_concurrency(), stats);
+                } else {
+                    runBenchmarks(file_name, stats);
+                }
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+        } else if (flag == "-p" && (argc == 3 || (argc == 5 && std::string(argv[3]) == "--threads"))) {
+            unsigned threads = argc == 5 ? std::stoi(argv[4]) : 0;
+            try {
+                runParallelBuild(argv[2], threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
         } else {
             std::cerr << "Unknown flag: " << flag << std::endl;
         }
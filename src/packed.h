@@ -0,0 +1,146 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include "search.h"
+
+/**
+ * Frame of reference encoding of an array of unsigned integers: the smallest entry as the
+ * base and every entry as its offset from the base in 1, 2 or 4 bytes, the narrowest width
+ * all offsets fit in. The offsets are byte aligned rather than bit packed so a sorted array
+ * is searched on them directly, 32 to 128 offsets per cache line, and decodes with one
+ * widening load per four entries.
+ *
+ * Only unsigned integers wider than a byte can be packed (supported); for other types the
+ * array stays empty and its members must not be called.
+*/
+template <typename T>
+class PackedArray {
+public:
+    static constexpr bool supported = std::is_integral_v<T> && std::is_unsigned_v<T> && sizeof(T) > 1;
+
+    PackedArray() : base(), count(0), width(0) {}
+
+    /**
+     * Narrowest width in bytes the offsets of values[0, n) fit in, or 0 when none is narrower
+     * than T itself and packing would not pay off.
+    */
+    static unsigned widthFor(const T *values, size_t n);
+
+    void assign(const T *values, size_t n, unsigned laneWidth);
+    void decode(T *out) const; // all size() entries
+    void clear();
+
+    inline size_t size() const { return count; }
+    inline size_t bytes() const { return count * width; }
+    inline const void* address(size_t i) const { return data.get() + i * width; }
+
+    inline T operator[](size_t i) const {
+        switch (width) {
+            case 1: return base + lanes<uint8_t>()[i];
+            case 2: return base + lanes<uint16_t>()[i];
+            default: return base + lanes<uint32_t>()[i];
+        }
+    }
+
+    // number of entries < probe and <= probe, the array must be sorted
+    inline size_t lowerBound(T probe) const { return bound<false>(probe); }
+    inline size_t upperBound(T probe) const { return bound<true>(probe); }
+
+private:
+    std::unique_ptr<uint8_t[]> data;
+    T base;
+    uint32_t count;
+    uint8_t width;
+
+    template <typename Lane>
+    inline const Lane* lanes() const { return reinterpret_cast<const Lane*>(data.get()); }
+
+    template <bool Inclusive>
+    size_t bound(T probe) const;
+
+    template <bool Inclusive, typename Lane>
+    inline size_t boundIn(T offset) const {
+        if (offset > T(Lane(~Lane()))) {
+            return count; // beyond every offset this width can hold
+        }
+        return Inclusive ? countLessEqual(lanes<Lane>(), count, Lane(offset))
+                         : countLess(lanes<Lane>(), count, Lane(offset));
+    }
+};
+
+template <typename T>
+unsigned PackedArray<T>::widthFor(const T *values, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    T low = values[0], high = values[0];
+    for (size_t i = 1; i < n; i++) {
+        low = std::min(low, values[i]);
+        high = std::max(high, values[i]);
+    }
+    T range = high - low;
+    for (unsigned laneWidth : {1u, 2u, 4u}) {
+        if (laneWidth < sizeof(T) && (range >> (8 * laneWidth - 1) >> 1) == 0) {
+            return laneWidth;
+        }
+    }
+    return 0;
+}
+
+template <typename T>
+void PackedArray<T>::assign(const T *values, size_t n, unsigned laneWidth) {
+    base = *std::min_element(values, values + n);
+    count = n;
+    width = laneWidth;
+    data = std::make_unique_for_overwrite<uint8_t[]>(bytes());
+    for (size_t i = 0; i < n; i++) {
+        T offset = values[i] - base;
+        switch (width) {
+            case 1: reinterpret_cast<uint8_t*>(data.get())[i] = offset; break;
+            case 2: reinterpret_cast<uint16_t*>(data.get())[i] = offset; break;
+            default: reinterpret_cast<uint32_t*>(data.get())[i] = offset; break;
+        }
+    }
+}
+
+template <typename T>
+void PackedArray<T>::decode(T *out) const {
+    if constexpr (std::is_same_v<T, uint64_t>) {
+        switch (width) {
+            case 1: widenOffsets(lanes<uint8_t>(), count, base, out); return;
+            case 2: widenOffsets(lanes<uint16_t>(), count, base, out); return;
+            default: widenOffsets(lanes<uint32_t>(), count, base, out); return;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (*this)[i];
+    }
+}
+
+template <typename T>
+void PackedArray<T>::clear() {
+    data.reset();
+    count = 0;
+    width = 0;
+}
+
+template <typename T>
+template <bool Inclusive>
+size_t PackedArray<T>::bound(T probe) const {
+    if (probe < base || (!Inclusive && probe == base)) {
+        return 0; // base is the smallest entry
+    }
+    T offset = probe - base;
+    switch (width) {
+        case 1: return boundIn<Inclusive, uint8_t>(offset);
+        case 2: return boundIn<Inclusive, uint16_t>(offset);
+        default: return boundIn<Inclusive, uint32_t>(offset);
+    }
+}
+
+#endif
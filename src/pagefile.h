@@ -0,0 +1,422 @@
+#ifndef PAGEFILE_H
+#define PAGEFILE_H
+
+#include "btree.h"
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * On disk format written by BTree::writePages and served by MappedBTree. The file is a
+ * sequence of DEFAULT_PAGE_SIZE pages addressed by number: page 0 holds the file header,
+ * leaves follow in key order from page 1 and the internal levels come after them bottom
+ * up, the root last. Node contents are stored SoA inside a page so the mapped pages are
+ * searched in place with the same key search as in memory nodes.
+*/
+typedef uint32_t PageNumber;
+
+#define NULL_PAGE 0 // page 0 is the file header, never a node
+#define PAGE_FILE_MAGIC "BTREEPG"
+#define PAGE_FILE_VERSION 1
+
+struct PageFileHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t pageSize;
+    uint32_t keySize, valueSize;
+    uint64_t pageCount;
+    uint64_t capacity;
+    uint32_t height;
+    PageNumber rootPage;
+};
+
+enum PageKind : uint16_t { LEAF_PAGE = 1, INTERNAL_PAGE = 2 };
+
+struct PageHeader {
+    uint16_t kind;
+    uint16_t count;     // records in a leaf, separator keys in an internal page
+    PageNumber nextLeaf;
+    PageNumber prevLeaf;
+    uint32_t reserved;
+};
+
+/**
+ * Offsets of the arrays inside one page. A leaf holds keys[leafCap] then values[leafCap],
+ * an internal page keys[innerCap] then children[innerCap + 1] where children[0] is the less
+ * than child and children[i + 1] holds keys >= keys[i].
+*/
+template <typename Key, typename Value, size_t PageSize = DEFAULT_PAGE_SIZE>
+struct PageLayout {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "page files store keys and values as raw bytes");
+
+    static constexpr size_t alignUp(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr size_t payload = PageSize - sizeof(PageHeader);
+    static constexpr size_t leafCap = (payload - alignof(Value)) / (sizeof(Key) + sizeof(Value));
+    static constexpr size_t innerCap = (payload - alignof(PageNumber) - sizeof(PageNumber)) / (sizeof(Key) + sizeof(PageNumber));
+    static constexpr size_t valuesOffset = alignUp(sizeof(PageHeader) + leafCap * sizeof(Key), alignof(Value));
+    static constexpr size_t childrenOffset = alignUp(sizeof(PageHeader) + innerCap * sizeof(Key), alignof(PageNumber));
+
+    static_assert(leafCap >= 3 && innerCap >= 3, "page too small for the key and value types");
+    static_assert(leafCap <= UINT16_MAX && innerCap <= UINT16_MAX, "page too large for the count field");
+
+    static inline const PageHeader* header(const char *page) { return reinterpret_cast<const PageHeader*>(page); }
+    static inline const Key* keys(const char *page) { return reinterpret_cast<const Key*>(page + sizeof(PageHeader)); }
+    static inline const Value* values(const char *page) { return reinterpret_cast<const Value*>(page + valuesOffset); }
+    static inline const PageNumber* children(const char *page) { return reinterpret_cast<const PageNumber*>(page + childrenOffset); }
+};
+
+/**
+ * Read only tree served straight from a memory mapped page file, opening it costs one
+ * mmap and a header check no matter how many keys it holds. Pages are faulted in by the
+ * kernel as lookups and scans touch them, and each page is checked as it is reached: a
+ * page number outside the file, a page of the wrong kind or a count beyond the page's
+ * capacity throws std::runtime_error instead of reading outside the mapping.
+*/
+template <typename Key = uint64_t, typename Value = uint64_t>
+class MappedBTree {
+public:
+    typedef Record<Key, Value> RecordType;
+    typedef PageLayout<Key, Value> Layout;
+
+    /**
+     * Same bounded iteration as BTree::Cursor over the leaf pages. Records are returned by
+     * value since keys and values are stored apart.
+    */
+    class Cursor {
+    public:
+        Cursor(const MappedBTree *tree, PageNumber page, size_t slot, Key lo, Key hi, bool forward = true);
+
+        bool valid() const;
+        inline Key key() const { return Layout::keys(tree->page(leaf))[slot]; }
+        inline Value value() const { return Layout::values(tree->page(leaf))[slot]; }
+        inline RecordType record() const { return RecordType {key(), value()}; }
+        void next();
+        void prev();
+
+    private:
+        const MappedBTree *tree;
+        PageNumber leaf;
+        size_t slot;
+        Key lo, hi;
+
+        void enterLeaf(PageNumber pageNumber, bool forward);
+    };
+
+    explicit MappedBTree(const std::string &path);
+    ~MappedBTree();
+    MappedBTree(MappedBTree &&other) noexcept;
+    MappedBTree(const MappedBTree&) = delete;
+    MappedBTree& operator=(const MappedBTree&) = delete;
+
+    uint64_t capacity;
+
+    std::optional<Value> lookUp(Key key) const; // empty when key is not in the file
+    Cursor scan(Key lo, Key hi) const;
+    Cursor scanReverse(Key lo, Key hi) const;
+    inline size_t height() const { return fileHeader()->height; }
+
+    inline const char* page(PageNumber pageNumber) const { return base + (size_t)pageNumber * DEFAULT_PAGE_SIZE; }
+
+private:
+    char *base;
+    size_t length;
+    uint64_t pageCount;
+
+    inline const PageFileHeader* fileHeader() const { return reinterpret_cast<const PageFileHeader*>(base); }
+    const char* checkedPage(PageNumber pageNumber, PageKind kind) const;
+    PageNumber findLeafPage(Key key) const;
+};
+
+template <typename Key, typename Value>
+MappedBTree<Key, Value>::MappedBTree(const std::string &path) : capacity(0), base(nullptr), length(0), pageCount(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("can not open page file " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < DEFAULT_PAGE_SIZE) {
+        close(fd);
+        throw std::runtime_error("page file " + path + " is truncated");
+    }
+    length = st.st_size;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file referenced
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("can not map page file " + path);
+    }
+    base = static_cast<char*>(mapping);
+
+    const PageFileHeader *header = fileHeader();
+    const char *problem = nullptr;
+    if (std::memcmp(header->magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC)) != 0) {
+        problem = " is not a page file";
+    } else if (header->formatVersion != PAGE_FILE_VERSION || header->pageSize != DEFAULT_PAGE_SIZE) {
+        problem = " has an unsupported format version or page size";
+    } else if (header->keySize != sizeof(Key) || header->valueSize != sizeof(Value)) {
+        problem = " was written for different key or value types";
+    } else if (header->pageCount > length / DEFAULT_PAGE_SIZE || header->rootPage == NULL_PAGE
+               || header->rootPage >= header->pageCount) {
+        problem = " is truncated";
+    } else if (header->height == 0 || header->height >= header->pageCount) {
+        problem = " has a corrupt header";
+    }
+    if (problem) {
+        munmap(base, length);
+        throw std::runtime_error("page file " + path + problem);
+    }
+    capacity = header->capacity;
+    pageCount = header->pageCount;
+}
+
+template <typename Key, typename Value>
+MappedBTree<Key, Value>::~MappedBTree() {
+    if (base) {
+        munmap(base, length);
+    }
+}
+
+template <typename Key, typename Value>
+MappedBTree<Key, Value>::MappedBTree(MappedBTree &&other) noexcept
+    : capacity(other.capacity), base(other.base), length(other.length), pageCount(other.pageCount) {
+    other.base = nullptr;
+    other.length = 0;
+}
+
+/**
+ * The page at pageNumber, after checking that it lies in the file, is of the expected kind
+ * and holds no more entries than a page of that kind can.
+*/
+template <typename Key, typename Value>
+const char* MappedBTree<Key, Value>::checkedPage(PageNumber pageNumber, PageKind kind) const {
+    if (pageNumber == NULL_PAGE || pageNumber >= pageCount) {
+        throw std::runtime_error("page file is corrupt: page " + std::to_string(pageNumber) + " is outside the file");
+    }
+    const char *pageData = page(pageNumber);
+    const PageHeader *header = Layout::header(pageData);
+    if (header->kind != kind || header->count > (kind == LEAF_PAGE ? Layout::leafCap : Layout::innerCap)) {
+        throw std::runtime_error("page file is corrupt: page " + std::to_string(pageNumber) + " has a bad header");
+    }
+    return pageData;
+}
+
+/**
+ * Every leaf sits height - 1 levels below the root, which also bounds a descent through
+ * corrupt child numbers.
+*/
+template <typename Key, typename Value>
+PageNumber MappedBTree<Key, Value>::findLeafPage(Key key) const {
+    PageNumber cur = fileHeader()->rootPage;
+    for (uint32_t level = fileHeader()->height; level > 1; level--) {
+        const char *curPage = checkedPage(cur, INTERNAL_PAGE);
+        size_t child = keyUpperBound(Layout::keys(curPage), Layout::header(curPage)->count, key);
+        cur = Layout::children(curPage)[child];
+    }
+    checkedPage(cur, LEAF_PAGE);
+    return cur;
+}
+
+template <typename Key, typename Value>
+std::optional<Value> MappedBTree<Key, Value>::lookUp(Key key) const {
+    const char *leafPage = page(findLeafPage(key));
+    size_t count = Layout::header(leafPage)->count;
+    size_t slot = keyLowerBound(Layout::keys(leafPage), count, key);
+    if (slot < count && Layout::keys(leafPage)[slot] == key) {
+        return Layout::values(leafPage)[slot];
+    }
+    return std::nullopt;
+}
+
+template <typename Key, typename Value>
+typename MappedBTree<Key, Value>::Cursor MappedBTree<Key, Value>::scan(Key lo, Key hi) const {
+    PageNumber leaf = findLeafPage(lo);
+    const char *leafPage = page(leaf);
+    size_t slot = keyLowerBound(Layout::keys(leafPage), Layout::header(leafPage)->count, lo);
+    if (slot < Layout::header(leafPage)->count) {
+        return Cursor(this, leaf, slot, lo, hi);
+    }
+    return Cursor(this, Layout::header(leafPage)->nextLeaf, 0, lo, hi);
+}
+
+template <typename Key, typename Value>
+typename MappedBTree<Key, Value>::Cursor MappedBTree<Key, Value>::scanReverse(Key lo, Key hi) const {
+    PageNumber leaf = findLeafPage(hi);
+    const char *leafPage = page(leaf);
+    size_t slot = keyUpperBound(Layout::keys(leafPage), Layout::header(leafPage)->count, hi);
+    if (slot > 0) {
+        return Cursor(this, leaf, slot - 1, lo, hi);
+    }
+    return Cursor(this, Layout::header(leafPage)->prevLeaf, 0, lo, hi, false);
+}
+
+template <typename Key, typename Value>
+MappedBTree<Key, Value>::Cursor::Cursor(const MappedBTree *tree, PageNumber page, size_t slot, Key lo, Key hi, bool forward)
+    : tree(tree), leaf(NULL_PAGE), slot(slot), lo(lo), hi(hi) {
+    enterLeaf(page, forward);
+}
+
+template <typename Key, typename Value>
+bool MappedBTree<Key, Value>::Cursor::valid() const {
+    if (leaf == NULL_PAGE) {
+        return false;
+    }
+    Key cur = key();
+    return !(cur < lo) && !(hi < cur);
+}
+
+template <typename Key, typename Value>
+void MappedBTree<Key, Value>::Cursor::next() {
+    const PageHeader *header = Layout::header(tree->page(leaf));
+    if (++slot < header->count) {
+        return;
+    }
+    slot = 0;
+    enterLeaf(header->nextLeaf, true);
+}
+
+template <typename Key, typename Value>
+void MappedBTree<Key, Value>::Cursor::prev() {
+    if (slot > 0) {
+        slot--;
+        return;
+    }
+    enterLeaf(Layout::header(tree->page(leaf))->prevLeaf, false);
+}
+
+/**
+ * Move onto pageNumber, skipping empty leaves in the direction of travel. Entering
+ * backwards starts at the last record of the leaf.
+*/
+template <typename Key, typename Value>
+void MappedBTree<Key, Value>::Cursor::enterLeaf(PageNumber pageNumber, bool forward) {
+    while (pageNumber != NULL_PAGE && Layout::header(tree->checkedPage(pageNumber, LEAF_PAGE))->count == 0) {
+        const PageHeader *emptyLeaf = Layout::header(tree->page(pageNumber));
+        pageNumber = forward ? emptyLeaf->nextLeaf : emptyLeaf->prevLeaf;
+    }
+    leaf = pageNumber;
+    if (leaf == NULL_PAGE) {
+        return;
+    }
+    const PageHeader *header = Layout::header(tree->page(leaf));
+    if (!forward) {
+        slot = header->count - 1;
+    }
+    PageNumber neighbour = forward ? header->nextLeaf : header->prevLeaf;
+    if (neighbour != NULL_PAGE && neighbour < tree->pageCount) {
+        __builtin_prefetch(tree->page(neighbour));
+    }
+}
+
+/**
+ * Leaves are repacked full into pages whatever LeafCap the tree uses, so any instantiation
+ * over the same Key and Value can write or open a page file.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::writePages(const std::string &path) {
+    typedef PageLayout<Key, Value> Layout;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("can not create page file " + path);
+    }
+
+    uint64_t records = 0;
+    for (Leaf *leafNode = leftmostLeaf();;) {
+        records += leafNode->size();
+        if (leafNode->nextLeaf == NULL_HANDLE) {
+            break;
+        }
+        leafNode = arena.leaf(leafNode->nextLeaf);
+    }
+
+    std::vector<char> buffer(DEFAULT_PAGE_SIZE);
+    out.write(buffer.data(), buffer.size()); // header page, filled in last
+
+    // leaves take pages 1..numLeaves, spread evenly so the last one is not nearly empty
+    size_t numLeaves = std::max<size_t>(1, packedNodeCount(records, Layout::leafCap));
+    std::vector<LevelEntry> level;
+    level.reserve(numLeaves);
+    Leaf *leafNode = leftmostLeaf();
+    size_t slot = 0;
+    for (size_t i = 0; i < numLeaves; i++) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        PageHeader *header = reinterpret_cast<PageHeader*>(buffer.data());
+        Key *keys = reinterpret_cast<Key*>(buffer.data() + sizeof(PageHeader));
+        Value *values = reinterpret_cast<Value*>(buffer.data() + Layout::valuesOffset);
+        size_t count = records ? packedNodeSize(records, numLeaves, i) : 0;
+        for (size_t j = 0; j < count; j++) {
+            while (slot == leafNode->size()) {
+                leafNode = arena.leaf(leafNode->nextLeaf);
+                slot = 0;
+            }
+            keys[j] = leafNode->key(slot);
+            values[j] = leafNode->value(slot);
+            slot++;
+        }
+        PageNumber pageNumber = i + 1;
+        header->kind = LEAF_PAGE;
+        header->count = count;
+        header->prevLeaf = i ? pageNumber - 1 : NULL_PAGE;
+        header->nextLeaf = i + 1 < numLeaves ? pageNumber + 1 : NULL_PAGE;
+        level.push_back({count ? keys[0] : Key(), pageNumber});
+        out.write(buffer.data(), buffer.size());
+    }
+
+    PageNumber nextPage = numLeaves + 1;
+    uint32_t levels = 1;
+    while (level.size() > 1) {
+        size_t numNodes = packedNodeCount(level.size(), Layout::innerCap + 1);
+        std::vector<LevelEntry> parents;
+        parents.reserve(numNodes);
+        size_t next = 0;
+        for (size_t i = 0; i < numNodes; i++) {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            PageHeader *header = reinterpret_cast<PageHeader*>(buffer.data());
+            Key *keys = reinterpret_cast<Key*>(buffer.data() + sizeof(PageHeader));
+            PageNumber *children = reinterpret_cast<PageNumber*>(buffer.data() + Layout::childrenOffset);
+            size_t count = packedNodeSize(level.size(), numNodes, i);
+            children[0] = level[next].handle;
+            for (size_t j = 1; j < count; j++) {
+                keys[j - 1] = level[next + j].firstKey;
+                children[j] = level[next + j].handle;
+            }
+            header->kind = INTERNAL_PAGE;
+            header->count = count - 1;
+            parents.push_back({level[next].firstKey, nextPage++});
+            next += count;
+            out.write(buffer.data(), buffer.size());
+        }
+        level.swap(parents);
+        levels++;
+    }
+
+    PageFileHeader fileHeader = {};
+    std::memcpy(fileHeader.magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC));
+    fileHeader.formatVersion = PAGE_FILE_VERSION;
+    fileHeader.pageSize = DEFAULT_PAGE_SIZE;
+    fileHeader.keySize = sizeof(Key);
+    fileHeader.valueSize = sizeof(Value);
+    fileHeader.pageCount = nextPage;
+    fileHeader.capacity = records;
+    fileHeader.height = levels;
+    fileHeader.rootPage = level.front().handle;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+    out.flush();
+    if (!out) {
+        throw std::runtime_error("failed writing page file " + path);
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+MappedBTree<Key, Value> BTree<Key, Value, LeafCap, InnerCap>::openMapped(const std::string &path) {
+    return MappedBTree<Key, Value>(path);
+}
+
+#endif
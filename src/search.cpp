@@ -0,0 +1,337 @@
+#include "search.h"
+#include <immintrin.h>
+#include <cstring>
+
+// Keys compared at once after binary search has narrowed the range, a few cache lines.
+// Narrow offsets get a window of the same size in bytes.
+#define SIMD_WINDOW 32
+
+typedef size_t (*CountFn)(const uint64_t *keys, size_t n, uint64_t probe);
+
+/**
+ * Binary search on the predicate (key <= probe or key < probe) until at most SIMD_WINDOW
+ * keys are left. Returns how many keys are known to satisfy it, n becomes the window size.
+*/
+template <bool Inclusive, typename T>
+static inline size_t narrow(const T *keys, size_t &n, T probe) {
+    constexpr size_t window = SIMD_WINDOW * sizeof(uint64_t) / sizeof(T);
+    size_t base = 0;
+    while (n > window) {
+        size_t half = n / 2;
+        T pivot = keys[base + half];
+        if (Inclusive ? pivot <= probe : pivot < probe) {
+            base += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return base;
+}
+
+template <bool Inclusive, typename T>
+static size_t countScalar(const T *keys, size_t n, T probe) {
+    const T *it = Inclusive ? std::upper_bound(keys, keys + n, probe)
+                            : std::lower_bound(keys, keys + n, probe);
+    return it - keys;
+}
+
+template <bool Inclusive>
+__attribute__((target("sse4.2,popcnt")))
+static size_t countSSE42(const uint64_t *keys, size_t n, uint64_t probe) {
+    size_t count = narrow<Inclusive>(keys, n, probe);
+    const uint64_t *window = keys + count;
+    // pcmpgtq is signed, flipping the sign bit turns it into an unsigned compare
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    const __m128i p = _mm_xor_si128(_mm_set1_epi64x(probe), sign);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(window + i)), sign);
+        __m128i cmp = Inclusive ? _mm_cmpgt_epi64(k, p) : _mm_cmpgt_epi64(p, k);
+        int bits = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(cmp)));
+        count += Inclusive ? 2 - bits : bits;
+    }
+    for (; i < n; i++) {
+        count += Inclusive ? window[i] <= probe : window[i] < probe;
+    }
+    return count;
+}
+
+template <bool Inclusive>
+__attribute__((target("avx2,popcnt")))
+static size_t countAVX2(const uint64_t *keys, size_t n, uint64_t probe) {
+    size_t count = narrow<Inclusive>(keys, n, probe);
+    const uint64_t *window = keys + count;
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i p = _mm256_xor_si256(_mm256_set1_epi64x(probe), sign);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i k = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(window + i)), sign);
+        __m256i cmp = Inclusive ? _mm256_cmpgt_epi64(k, p) : _mm256_cmpgt_epi64(p, k);
+        int bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(cmp)));
+        count += Inclusive ? 4 - bits : bits;
+    }
+    for (; i < n; i++) {
+        count += Inclusive ? window[i] <= probe : window[i] < probe;
+    }
+    return count;
+}
+
+template <bool Inclusive>
+__attribute__((target("avx512f,popcnt")))
+static size_t countAVX512(const uint64_t *keys, size_t n, uint64_t probe) {
+    size_t count = narrow<Inclusive>(keys, n, probe);
+    const uint64_t *window = keys + count;
+    const __m512i p = _mm512_set1_epi64(probe);
+    size_t i = 0;
+    for (; i < n; i += 8) {
+        // the final partial vector is loaded under a mask instead of a scalar tail
+        __mmask8 valid = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        __m512i k = _mm512_maskz_loadu_epi64(valid, window + i);
+        __mmask8 hits = Inclusive ? _mm512_mask_cmple_epu64_mask(valid, k, p)
+                                  : _mm512_mask_cmplt_epu64_mask(valid, k, p);
+        count += __builtin_popcount(hits);
+    }
+    return count;
+}
+
+/**
+ * Kernels over the 8, 16 and 32 bit offsets of packed arrays. There is no unsigned compare
+ * below avx512bw, so like the uint64_t paths they flip the sign bit and compare signed;
+ * movemask yields sizeof(Lane) bits per lane. AVX512 cpus run the AVX2 kernels.
+*/
+template <typename Lane>
+static inline __m128i broadcast128(Lane value) {
+    if constexpr (sizeof(Lane) == 1) {
+        return _mm_set1_epi8((char)value);
+    } else if constexpr (sizeof(Lane) == 2) {
+        return _mm_set1_epi16((short)value);
+    } else {
+        return _mm_set1_epi32((int)value);
+    }
+}
+
+template <typename Lane>
+static inline __m128i greater128(__m128i a, __m128i b) {
+    if constexpr (sizeof(Lane) == 1) {
+        return _mm_cmpgt_epi8(a, b);
+    } else if constexpr (sizeof(Lane) == 2) {
+        return _mm_cmpgt_epi16(a, b);
+    } else {
+        return _mm_cmpgt_epi32(a, b);
+    }
+}
+
+template <typename Lane>
+__attribute__((target("avx2")))
+static inline __m256i broadcast256(Lane value) {
+    if constexpr (sizeof(Lane) == 1) {
+        return _mm256_set1_epi8((char)value);
+    } else if constexpr (sizeof(Lane) == 2) {
+        return _mm256_set1_epi16((short)value);
+    } else {
+        return _mm256_set1_epi32((int)value);
+    }
+}
+
+template <typename Lane>
+__attribute__((target("avx2")))
+static inline __m256i greater256(__m256i a, __m256i b) {
+    if constexpr (sizeof(Lane) == 1) {
+        return _mm256_cmpgt_epi8(a, b);
+    } else if constexpr (sizeof(Lane) == 2) {
+        return _mm256_cmpgt_epi16(a, b);
+    } else {
+        return _mm256_cmpgt_epi32(a, b);
+    }
+}
+
+template <bool Inclusive, typename Lane>
+__attribute__((target("sse4.2,popcnt")))
+static size_t countLanesSSE42(const Lane *lanes, size_t n, Lane probe) {
+    constexpr size_t perVector = 16 / sizeof(Lane);
+    size_t count = narrow<Inclusive>(lanes, n, probe);
+    const Lane *window = lanes + count;
+    const __m128i sign = broadcast128<Lane>(Lane(1) << (8 * sizeof(Lane) - 1));
+    const __m128i p = _mm_xor_si128(broadcast128<Lane>(probe), sign);
+    size_t i = 0;
+    for (; i + perVector <= n; i += perVector) {
+        __m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(window + i)), sign);
+        __m128i cmp = Inclusive ? greater128<Lane>(k, p) : greater128<Lane>(p, k);
+        size_t hits = __builtin_popcount(_mm_movemask_epi8(cmp)) / sizeof(Lane);
+        count += Inclusive ? perVector - hits : hits;
+    }
+    for (; i < n; i++) {
+        count += Inclusive ? window[i] <= probe : window[i] < probe;
+    }
+    return count;
+}
+
+template <bool Inclusive, typename Lane>
+__attribute__((target("avx2,popcnt")))
+static size_t countLanesAVX2(const Lane *lanes, size_t n, Lane probe) {
+    constexpr size_t perVector = 32 / sizeof(Lane);
+    size_t count = narrow<Inclusive>(lanes, n, probe);
+    const Lane *window = lanes + count;
+    const __m256i sign = broadcast256<Lane>(Lane(1) << (8 * sizeof(Lane) - 1));
+    const __m256i p = _mm256_xor_si256(broadcast256<Lane>(probe), sign);
+    size_t i = 0;
+    for (; i + perVector <= n; i += perVector) {
+        __m256i k = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(window + i)), sign);
+        __m256i cmp = Inclusive ? greater256<Lane>(k, p) : greater256<Lane>(p, k);
+        size_t hits = __builtin_popcount((uint32_t)_mm256_movemask_epi8(cmp)) / sizeof(Lane);
+        count += Inclusive ? perVector - hits : hits;
+    }
+    for (; i < n; i++) {
+        count += Inclusive ? window[i] <= probe : window[i] < probe;
+    }
+    return count;
+}
+
+template <typename Lane>
+static void widenScalar(const Lane *lanes, size_t n, uint64_t base, uint64_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = base + lanes[i];
+    }
+}
+
+template <typename Lane>
+__attribute__((target("avx2")))
+static void widenAVX2(const Lane *lanes, size_t n, uint64_t base, uint64_t *out) {
+    const __m256i b = _mm256_set1_epi64x(base);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i wide;
+        if constexpr (sizeof(Lane) == 1) {
+            uint32_t four;
+            std::memcpy(&four, lanes + i, sizeof(four));
+            wide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+        } else if constexpr (sizeof(Lane) == 2) {
+            wide = _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i*)(lanes + i)));
+        } else {
+            wide = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(lanes + i)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi64(wide, b));
+    }
+    widenScalar(lanes + i, n - i, base, out + i);
+}
+
+struct SearchDispatch {
+    SearchPath path;
+    CountFn lessEqual;
+    CountFn less;
+};
+
+static SearchDispatch dispatchFor(SearchPath path) {
+    switch (path) {
+        case SearchPath::AVX512: return {path, countAVX512<true>, countAVX512<false>};
+        case SearchPath::AVX2: return {path, countAVX2<true>, countAVX2<false>};
+        case SearchPath::SSE42: return {path, countSSE42<true>, countSSE42<false>};
+        default: return {SearchPath::Scalar, countScalar<true, uint64_t>, countScalar<false, uint64_t>};
+    }
+}
+
+static SearchDispatch bestDispatch() {
+    for (SearchPath path : {SearchPath::AVX512, SearchPath::AVX2, SearchPath::SSE42}) {
+        if (searchPathSupported(path)) {
+            return dispatchFor(path);
+        }
+    }
+    return dispatchFor(SearchPath::Scalar);
+}
+
+static SearchDispatch dispatch = bestDispatch();
+
+bool searchPathSupported(SearchPath path) {
+    __builtin_cpu_init();
+    switch (path) {
+        case SearchPath::AVX512: return __builtin_cpu_supports("avx512f");
+        case SearchPath::AVX2: return __builtin_cpu_supports("avx2");
+        case SearchPath::SSE42: return __builtin_cpu_supports("sse4.2");
+        default: return true;
+    }
+}
+
+bool setSearchPath(SearchPath path) {
+    if (!searchPathSupported(path)) {
+        return false;
+    }
+    dispatch = dispatchFor(path);
+    return true;
+}
+
+SearchPath activeSearchPath() {
+    return dispatch.path;
+}
+
+std::string searchPathName(SearchPath path) {
+    switch (path) {
+        case SearchPath::AVX512: return "avx512";
+        case SearchPath::AVX2: return "avx2";
+        case SearchPath::SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
+
+size_t countLessEqual(const uint64_t *keys, size_t n, uint64_t probe) {
+    return dispatch.lessEqual(keys, n, probe);
+}
+
+size_t countLess(const uint64_t *keys, size_t n, uint64_t probe) {
+    return dispatch.less(keys, n, probe);
+}
+
+template <bool Inclusive, typename Lane>
+static size_t countLanes(const Lane *lanes, size_t n, Lane probe) {
+    switch (dispatch.path) {
+        case SearchPath::AVX512:
+        case SearchPath::AVX2: return countLanesAVX2<Inclusive>(lanes, n, probe);
+        case SearchPath::SSE42: return countLanesSSE42<Inclusive>(lanes, n, probe);
+        default: return countScalar<Inclusive>(lanes, n, probe);
+    }
+}
+
+size_t countLessEqual(const uint32_t *lanes, size_t n, uint32_t probe) {
+    return countLanes<true>(lanes, n, probe);
+}
+
+size_t countLessEqual(const uint16_t *lanes, size_t n, uint16_t probe) {
+    return countLanes<true>(lanes, n, probe);
+}
+
+size_t countLessEqual(const uint8_t *lanes, size_t n, uint8_t probe) {
+    return countLanes<true>(lanes, n, probe);
+}
+
+size_t countLess(const uint32_t *lanes, size_t n, uint32_t probe) {
+    return countLanes<false>(lanes, n, probe);
+}
+
+size_t countLess(const uint16_t *lanes, size_t n, uint16_t probe) {
+    return countLanes<false>(lanes, n, probe);
+}
+
+size_t countLess(const uint8_t *lanes, size_t n, uint8_t probe) {
+    return countLanes<false>(lanes, n, probe);
+}
+
+template <typename Lane>
+static void widen(const Lane *lanes, size_t n, uint64_t base, uint64_t *out) {
+    if (dispatch.path == SearchPath::AVX2 || dispatch.path == SearchPath::AVX512) {
+        widenAVX2(lanes, n, base, out);
+    } else {
+        widenScalar(lanes, n, base, out);
+    }
+}
+
+void widenOffsets(const uint32_t *lanes, size_t n, uint64_t base, uint64_t *out) {
+    widen(lanes, n, base, out);
+}
+
+void widenOffsets(const uint16_t *lanes, size_t n, uint64_t base, uint64_t *out) {
+    widen(lanes, n, base, out);
+}
+
+void widenOffsets(const uint8_t *lanes, size_t n, uint64_t base, uint64_t *out) {
+    widen(lanes, n, base, out);
+}
@@ -0,0 +1,70 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <algorithm>
+
+/**
+ * Instruction set used by the uint64_t node search and the packed leaf kernels. The best
+ * one the cpu supports is picked at startup, setSearchPath() overrides it (e.g. to benchmark
+ * the paths against each other).
+*/
+enum class SearchPath { Scalar, SSE42, AVX2, AVX512 };
+
+bool searchPathSupported(SearchPath path);
+bool setSearchPath(SearchPath path);
+SearchPath activeSearchPath();
+std::string searchPathName(SearchPath path);
+
+/**
+ * Number of keys in the sorted array that are <= probe, i.e. the upper bound. Binary
+ * search narrows the array to a small window which is then compared in one vector pass.
+*/
+size_t countLessEqual(const uint64_t *keys, size_t n, uint64_t probe);
+
+/**
+ * Number of keys in the sorted array that are < probe, i.e. the lower bound.
+*/
+size_t countLess(const uint64_t *keys, size_t n, uint64_t probe);
+
+/**
+ * The same bounds over the narrow offsets of a packed array (packed.h), so a packed leaf is
+ * searched without decoding it. Wider vectors compare 4 to 32 offsets per instruction.
+*/
+size_t countLessEqual(const uint32_t *lanes, size_t n, uint32_t probe);
+size_t countLessEqual(const uint16_t *lanes, size_t n, uint16_t probe);
+size_t countLessEqual(const uint8_t *lanes, size_t n, uint8_t probe);
+size_t countLess(const uint32_t *lanes, size_t n, uint32_t probe);
+size_t countLess(const uint16_t *lanes, size_t n, uint16_t probe);
+size_t countLess(const uint8_t *lanes, size_t n, uint8_t probe);
+
+/**
+ * out[i] = base + lanes[i] for every i < n, the decode of a packed array.
+*/
+void widenOffsets(const uint32_t *lanes, size_t n, uint64_t base, uint64_t *out);
+void widenOffsets(const uint16_t *lanes, size_t n, uint64_t base, uint64_t *out);
+void widenOffsets(const uint8_t *lanes, size_t n, uint64_t base, uint64_t *out);
+
+template <typename Key>
+inline size_t keyUpperBound(const Key *keys, size_t n, const Key &probe) {
+    return std::upper_bound(keys, keys + n, probe) - keys;
+}
+
+template <typename Key>
+inline size_t keyLowerBound(const Key *keys, size_t n, const Key &probe) {
+    return std::lower_bound(keys, keys + n, probe) - keys;
+}
+
+template <>
+inline size_t keyUpperBound<uint64_t>(const uint64_t *keys, size_t n, const uint64_t &probe) {
+    return countLessEqual(keys, n, probe);
+}
+
+template <>
+inline size_t keyLowerBound<uint64_t>(const uint64_t *keys, size_t n, const uint64_t &probe) {
+    return countLess(keys, n, probe);
+}
+
+#endif
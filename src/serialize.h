@@ -6,6 +6,84 @@
 
 using json = nlohmann::json;
 
-std::string serialize(const std::unique_ptr<BTree> &tree);
+/**
+ * Debug export of the whole tree structure for the interactive json_state command. Nodes
+ * are listed level by level from the root; use BTree::save for anything of real size.
+*/
+template <typename Tree>
+std::string serialize(const std::unique_ptr<Tree> &tree) {
+    json tree_repr;
+    tree_repr["height"] = tree->height();
+    tree_repr["total_capacity"] = tree->capacity;
+    tree_repr["root"] = handleName(tree->rootNode);
+    tree_repr["nodes"] = json::array();
 
-#endif
\ No newline at end of file
+    std::queue<NodeHandle> pending;
+    pending.push(tree->rootNode);
+    while (!pending.empty()) {
+        NodeHandle handle = pending.front();
+        pending.pop();
+        json node;
+        node["id"] = handleName(handle);
+        if (tree->arena.isLeaf(handle)) {
+            auto *leaf = tree->arena.leaf(handle);
+            node["kind"] = "leaf";
+            std::vector<typename Tree::RecordType::KeyType> keys(leaf->size());
+            for (size_t slot = 0; slot < keys.size(); slot++) {
+                keys[slot] = leaf->key(slot);
+            }
+            node["keys"] = keys;
+            node["packed"] = leaf->isPacked();
+            node["prev"] = handleName(leaf->prevLeaf);
+            node["next"] = handleName(leaf->nextLeaf);
+        } else {
+            auto *internal = tree->arena.internal(handle);
+            node["kind"] = "internal";
+            node["keys"] = internal->keys;
+            node["children"] = json::array({handleName(internal->ltChildPtr)});
+            pending.push(internal->ltChildPtr);
+            for (NodeHandle child : internal->gtChildren) {
+                node["children"].push_back(handleName(child));
+                pending.push(child);
+            }
+        }
+        tree_repr["nodes"].push_back(node);
+    }
+    return tree_repr.dump();
+}
+
+/**
+ * Answer to the interactive stats command. Operation counts are zero unless the program was
+ * built with BTREE_STATS; hardware counts are left out when there are none.
+*/
+inline std::string serializeStats(const TreeStats &stats, const HardwareCounters *hardware = nullptr) {
+    json stats_repr;
+    stats_repr["stats_enabled"] = statsEnabled;
+    stats_repr["operations"] = json::object();
+    for (size_t i = 0; i < stats.operations.size(); i++) {
+        stats_repr["operations"][statNames[i]] = stats.operations[i];
+    }
+    uint64_t descents = stats.operations[static_cast<size_t>(Stat::Descents)];
+    stats_repr["nodes_visited_per_descent"] =
+        descents ? (double)stats.operations[static_cast<size_t>(Stat::NodesVisited)] / descents : 0;
+    stats_repr["height"] = stats.height;
+    stats_repr["leaves"] = stats.leaves;
+    stats_repr["internal_nodes"] = stats.internalNodes;
+    stats_repr["records"] = stats.records;
+    stats_repr["leaf_fill"] = stats.leafFill;
+    stats_repr["internal_fill"] = stats.internalFill;
+    stats_repr["bytes_in_use"] = stats.bytesInUse;
+    stats_repr["bytes_reserved"] = stats.bytesReserved;
+    if (hardware && hardware->available()) {
+        HardwareCounts counts = hardware->read();
+        stats_repr["hardware"] = {
+            {"cycles", counts.cycles},
+            {"instructions", counts.instructions},
+            {"cache_misses", counts.cacheMisses},
+            {"branch_misses", counts.branchMisses},
+        };
+    }
+    return stats_repr.dump();
+}
+
+#endif
@@ -0,0 +1,564 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "btree.h"
+#include "wal.h"
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Binary request protocol of the server mode. Every message in either direction is a frame:
+ * a little endian uint32 length of the rest of the frame, then an op (requests) or a status
+ * (responses) byte, then the fields below as little endian integers.
+ *
+ *   Insert  key u64, value u64          -> Ok
+ *   LookUp  key u64                     -> Ok value u64 | NotFound
+ *   Remove  key u64                     -> Ok | NotFound
+ *   Scan    lo u64, hi u64, limit u32   -> Ok count u32, count x (key u64, value u64)
+ *
+ * A malformed request is answered with Error and the connection stays usable; a frame
+ * longer than SERVER_MAX_FRAME closes it. Requests are pipelined: a client may send any
+ * number of frames before reading, responses come back in request order. The server answers
+ * everything it read in one pass with a single write, so a pipelined batch costs one
+ * syscall each way instead of one per request.
+*/
+#define SERVER_MAX_FRAME (1 << 20)
+#define SERVER_READ_CHUNK (64 << 10)
+// a connection is not read from while this much of its output is still unsent
+#define SERVER_MAX_BACKLOG (4 << 20)
+
+enum class ServerOp : uint8_t { Insert = 1, LookUp = 2, Remove = 3, Scan = 4 };
+enum class ServerStatus : uint8_t { Ok = 0, NotFound = 1, Error = 2 };
+
+template <typename T>
+inline void storeLittleEndian(char *out, T value) {
+    if constexpr (std::endian::native == std::endian::big && sizeof(T) == 8) {
+        value = __builtin_bswap64(value);
+    } else if constexpr (std::endian::native == std::endian::big && sizeof(T) == 4) {
+        value = __builtin_bswap32(value);
+    }
+    std::memcpy(out, &value, sizeof(T));
+}
+
+template <typename T>
+inline void appendLittleEndian(std::vector<char> &out, T value) {
+    out.resize(out.size() + sizeof(T));
+    storeLittleEndian(out.data() + out.size() - sizeof(T), value);
+}
+
+template <typename T>
+inline T readLittleEndian(const char *in) {
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big && sizeof(T) == 8) {
+        value = __builtin_bswap64(value);
+    } else if constexpr (std::endian::native == std::endian::big && sizeof(T) == 4) {
+        value = __builtin_bswap32(value);
+    }
+    return value;
+}
+
+/**
+ * Single threaded epoll server for one tree on a Unix domain socket and optionally a TCP
+ * port on the loopback interface. run() serves until stop() is called, which is safe from
+ * other threads and from signal handlers. Inserts and removes go to wal first when given,
+ * as in interactive mode, and are only acknowledged once the log has them on disk; one group
+ * commit covers every write of a pipelined batch.
+*/
+template <typename Tree>
+class TreeServer {
+public:
+    typedef typename Tree::RecordType RecordType;
+    static_assert(sizeof(typename RecordType::KeyType) == 8 && sizeof(typename RecordType::ValueType) == 8,
+                  "the protocol carries 64 bit keys and values");
+
+    TreeServer(Tree &tree, WriteAheadLog<> *wal = nullptr);
+    ~TreeServer();
+    TreeServer(const TreeServer&) = delete;
+    TreeServer& operator=(const TreeServer&) = delete;
+
+    void listenUnix(const std::string &path); // replaces a stale socket file at path
+    uint16_t listenTcp(uint16_t port);        // port 0 picks a free one, returns the port bound
+    void run();
+    void stop();
+
+private:
+    struct Connection {
+        int fd;
+        std::vector<char> in, out;
+        size_t inEnd = 0, outStart = 0;
+        uint32_t events = 0;
+        uint64_t logged = 0; // last wal sequence answered in out, durable before out is sent
+        bool peerClosed = false;
+    };
+
+    Tree &tree;
+    WriteAheadLog<> *wal;
+    int epollFd, wakeFd;
+    std::vector<int> listeners;
+    std::string unixPath;
+    std::unordered_map<int, Connection> connections;
+
+    void watch(int fd, uint32_t events);
+    void acceptAll(int listener);
+    bool readFrom(Connection &connection);
+    bool writeTo(Connection &connection);
+    bool updateInterest(Connection &connection);
+    bool serveFrames(Connection &connection);
+    void serve(const char *request, uint32_t length, Connection &connection);
+};
+
+template <typename Tree>
+TreeServer<Tree>::TreeServer(Tree &tree, WriteAheadLog<> *wal) : tree(tree), wal(wal) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd < 0 || wakeFd < 0) {
+        throw std::runtime_error("can not create the server event loop");
+    }
+    watch(wakeFd, EPOLLIN);
+}
+
+template <typename Tree>
+TreeServer<Tree>::~TreeServer() {
+    for (auto &[fd, connection] : connections) {
+        close(fd);
+    }
+    for (int listener : listeners) {
+        close(listener);
+    }
+    if (!unixPath.empty()) {
+        unlink(unixPath.c_str());
+    }
+    close(wakeFd);
+    close(epollFd);
+}
+
+template <typename Tree>
+void TreeServer<Tree>::watch(int fd, uint32_t events) {
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error("can not watch server socket");
+    }
+}
+
+template <typename Tree>
+void TreeServer<Tree>::listenUnix(const std::string &path) {
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("can not listen on " + path + ": " + std::strerror(errno));
+    }
+    unixPath = path;
+    listeners.push_back(fd);
+    watch(fd, EPOLLIN);
+}
+
+template <typename Tree>
+uint16_t TreeServer<Tree>::listenTcp(uint16_t port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    socklen_t length = sizeof(address);
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+        || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("can not listen on port " + std::to_string(port) + ": " + std::strerror(errno));
+    }
+    listeners.push_back(fd);
+    watch(fd, EPOLLIN);
+    return ntohs(address.sin_port);
+}
+
+template <typename Tree>
+void TreeServer<Tree>::stop() {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(wakeFd, &one, sizeof(one)); // async signal safe
+}
+
+template <typename Tree>
+void TreeServer<Tree>::run() {
+    std::vector<epoll_event> events(64);
+    for (;;) {
+        int ready = epoll_wait(epollFd, events.data(), events.size(), -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+        }
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                uint64_t count;
+                [[maybe_unused]] ssize_t drained = read(wakeFd, &count, sizeof(count));
+                return;
+            }
+            if (std::find(listeners.begin(), listeners.end(), fd) != listeners.end()) {
+                acceptAll(fd);
+                continue;
+            }
+            auto found = connections.find(fd);
+            if (found == connections.end()) {
+                continue;
+            }
+            Connection &connection = found->second;
+            bool open = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                open = readFrom(connection);
+            }
+            open = open && writeTo(connection) && updateInterest(connection);
+            if (!open) {
+                close(fd); // also drops it from the epoll set
+                connections.erase(found);
+            }
+        }
+    }
+}
+
+template <typename Tree>
+void TreeServer<Tree>::acceptAll(int listener) {
+    for (;;) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN once the backlog is empty, anything else is the client's problem
+        }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)); // fails harmlessly on Unix sockets
+        Connection &connection = connections[fd];
+        connection.fd = fd;
+        connection.events = EPOLLIN;
+        watch(fd, EPOLLIN);
+    }
+}
+
+/**
+ * Read whatever the socket holds and answer every complete frame in it. Returns false when
+ * the connection has to be closed.
+*/
+template <typename Tree>
+bool TreeServer<Tree>::readFrom(Connection &connection) {
+    while (connection.out.size() - connection.outStart < SERVER_MAX_BACKLOG) {
+        if (connection.in.size() - connection.inEnd < SERVER_READ_CHUNK) {
+            connection.in.resize(connection.inEnd + SERVER_READ_CHUNK);
+        }
+        ssize_t received = recv(connection.fd, connection.in.data() + connection.inEnd,
+                                connection.in.size() - connection.inEnd, 0);
+        if (received == 0) {
+            connection.peerClosed = true; // half closed, the responses still go out
+            break;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.inEnd += received;
+        if (!serveFrames(connection)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Tree>
+bool TreeServer<Tree>::serveFrames(Connection &connection) {
+    size_t next = 0;
+    while (connection.inEnd - next >= sizeof(uint32_t)) {
+        uint32_t length = readLittleEndian<uint32_t>(connection.in.data() + next);
+        if (length == 0 || length > SERVER_MAX_FRAME) {
+            return false; // framing is lost, nothing after this can be trusted
+        }
+        if (connection.inEnd - next - sizeof(uint32_t) < length) {
+            break;
+        }
+        serve(connection.in.data() + next + sizeof(uint32_t), length, connection);
+        next += sizeof(uint32_t) + length;
+    }
+    std::memmove(connection.in.data(), connection.in.data() + next, connection.inEnd - next);
+    connection.inEnd -= next;
+    return true;
+}
+
+template <typename Tree>
+bool TreeServer<Tree>::writeTo(Connection &connection) {
+    if (connection.logged) {
+        wal->waitDurable(connection.logged);
+        connection.logged = 0;
+    }
+    while (connection.outStart < connection.out.size()) {
+        ssize_t sent = send(connection.fd, connection.out.data() + connection.outStart,
+                            connection.out.size() - connection.outStart, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.outStart += sent;
+    }
+    connection.out.clear();
+    connection.outStart = 0;
+    return true;
+}
+
+/**
+ * Wait for output space while responses are pending and for input while the backlog allows
+ * it. A half closed connection is closed once its last response went out.
+*/
+template <typename Tree>
+bool TreeServer<Tree>::updateInterest(Connection &connection) {
+    size_t backlog = connection.out.size() - connection.outStart;
+    uint32_t events = (backlog ? uint32_t(EPOLLOUT) : 0)
+                      | (!connection.peerClosed && backlog < SERVER_MAX_BACKLOG ? uint32_t(EPOLLIN) : 0);
+    if (events == 0) {
+        return false;
+    }
+    if (events != connection.events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+    return true;
+}
+
+template <typename Tree>
+void TreeServer<Tree>::serve(const char *request, uint32_t length, Connection &connection) {
+    std::vector<char> &out = connection.out;
+    size_t frame = out.size();
+    appendLittleEndian<uint32_t>(out, 0); // patched below
+    const char *fields = request + 1;
+    ServerStatus status = ServerStatus::Error;
+    size_t statusAt = out.size();
+    out.push_back(0);
+
+    switch (static_cast<ServerOp>(request[0])) {
+        case ServerOp::Insert:
+            if (length == 1 + 16) {
+                uint64_t key = readLittleEndian<uint64_t>(fields), value = readLittleEndian<uint64_t>(fields + 8);
+                if (wal) {
+                    connection.logged = wal->append(WalOp::Insert, key, value);
+                }
+                tree.insert(RecordType {key, value});
+                status = ServerStatus::Ok;
+            }
+            break;
+        case ServerOp::LookUp:
+            if (length == 1 + 8) {
+                auto value = tree.lookUp(readLittleEndian<uint64_t>(fields));
+                status = value ? ServerStatus::Ok : ServerStatus::NotFound;
+                if (value) {
+                    appendLittleEndian<uint64_t>(out, *value);
+                }
+            }
+            break;
+        case ServerOp::Remove:
+            if (length == 1 + 8) {
+                uint64_t key = readLittleEndian<uint64_t>(fields);
+                if (wal) {
+                    connection.logged = wal->append(WalOp::Remove, key);
+                }
+                status = tree.remove(key) ? ServerStatus::Ok : ServerStatus::NotFound;
+            }
+            break;
+        case ServerOp::Scan:
+            if (length == 1 + 20) {
+                uint64_t lo = readLittleEndian<uint64_t>(fields), hi = readLittleEndian<uint64_t>(fields + 8);
+                // the response has to fit in one frame
+                uint32_t limit = std::min<uint32_t>(readLittleEndian<uint32_t>(fields + 16), (SERVER_MAX_FRAME - 5) / 16);
+                size_t countAt = out.size();
+                appendLittleEndian<uint32_t>(out, 0);
+                uint32_t count = 0;
+                for (auto cursor = tree.scan(lo, hi); cursor.valid() && count < limit; cursor.next(), count++) {
+                    appendLittleEndian<uint64_t>(out, cursor.key());
+                    appendLittleEndian<uint64_t>(out, cursor.value());
+                }
+                storeLittleEndian<uint32_t>(out.data() + countAt, count);
+                status = ServerStatus::Ok;
+            }
+            break;
+    }
+    if (status == ServerStatus::Error) {
+        out.resize(statusAt + 1);
+    }
+    out[statusAt] = static_cast<char>(status);
+    storeLittleEndian<uint32_t>(out.data() + frame, out.size() - frame - sizeof(uint32_t));
+}
+
+/**
+ * Blocking client for the server protocol. Requests are queued and go out together on
+ * flush(); next() then returns their responses in order. The server stops reading from a
+ * client whose unread responses pass SERVER_MAX_BACKLOG, so a pipelined batch should be
+ * read back before the next one is sent.
+*/
+class TreeClient {
+public:
+    struct Response {
+        ServerStatus status;
+        uint64_t value = 0;                                   // LookUp
+        std::vector<std::pair<uint64_t, uint64_t>> records;   // Scan
+    };
+
+    explicit TreeClient(const std::string &unixPath);
+    explicit TreeClient(uint16_t tcpPort);
+    ~TreeClient() { close(fd); }
+    TreeClient(const TreeClient&) = delete;
+    TreeClient& operator=(const TreeClient&) = delete;
+
+    void insert(uint64_t key, uint64_t value) { request(ServerOp::Insert, {key, value}); }
+    void lookUp(uint64_t key) { request(ServerOp::LookUp, {key}); }
+    void remove(uint64_t key) { request(ServerOp::Remove, {key}); }
+    void scan(uint64_t lo, uint64_t hi, uint32_t limit) { request(ServerOp::Scan, {lo, hi}, &limit); }
+    void raw(const std::vector<char> &frame); // an arbitrary frame, for testing the server's checks
+
+    void flush();
+    Response next();
+
+private:
+    int fd;
+    std::vector<char> out, in;
+    size_t inStart = 0;
+    std::deque<ServerOp> pending;
+
+    void request(ServerOp op, std::initializer_list<uint64_t> fields, const uint32_t *tail = nullptr);
+    void connectTo(const sockaddr *address, socklen_t length, int family);
+    void fill(size_t bytes);
+};
+
+inline void TreeClient::connectTo(const sockaddr *address, socklen_t length, int family) {
+    fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, address, length) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error(std::string("can not connect to the server: ") + std::strerror(errno));
+    }
+}
+
+inline TreeClient::TreeClient(const std::string &unixPath) {
+    sockaddr_un address = {};
+    if (unixPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path too long: " + unixPath);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, unixPath.c_str(), unixPath.size() + 1);
+    connectTo(reinterpret_cast<sockaddr*>(&address), sizeof(address), AF_UNIX);
+}
+
+inline TreeClient::TreeClient(uint16_t tcpPort) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(tcpPort);
+    connectTo(reinterpret_cast<sockaddr*>(&address), sizeof(address), AF_INET);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+}
+
+inline void TreeClient::request(ServerOp op, std::initializer_list<uint64_t> fields, const uint32_t *tail) {
+    appendLittleEndian<uint32_t>(out, 1 + fields.size() * 8 + (tail ? 4 : 0));
+    out.push_back(static_cast<char>(op));
+    for (uint64_t field : fields) {
+        appendLittleEndian<uint64_t>(out, field);
+    }
+    if (tail) {
+        appendLittleEndian<uint32_t>(out, *tail);
+    }
+    pending.push_back(op);
+}
+
+inline void TreeClient::raw(const std::vector<char> &frame) {
+    out.insert(out.end(), frame.begin(), frame.end());
+    pending.push_back(ServerOp(0));
+}
+
+inline void TreeClient::flush() {
+    for (size_t sent = 0; sent < out.size();) {
+        ssize_t written = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("server connection failed: ") + std::strerror(errno));
+        }
+        sent += std::max<ssize_t>(written, 0);
+    }
+    out.clear();
+}
+
+// make at least bytes unread bytes available in in[inStart, ...)
+inline void TreeClient::fill(size_t bytes) {
+    if (inStart > 0) {
+        in.erase(in.begin(), in.begin() + inStart);
+        inStart = 0;
+    }
+    while (in.size() < bytes) {
+        size_t have = in.size();
+        in.resize(std::max(bytes, have + SERVER_READ_CHUNK));
+        ssize_t received = recv(fd, in.data() + have, in.size() - have, 0);
+        in.resize(have + std::max<ssize_t>(received, 0));
+        if (received == 0 || (received < 0 && errno != EINTR)) {
+            throw std::runtime_error("server closed the connection");
+        }
+    }
+}
+
+inline TreeClient::Response TreeClient::next() {
+    if (pending.empty()) {
+        throw std::runtime_error("no request is waiting for a response");
+    }
+    if (in.size() - inStart < 4) {
+        fill(4);
+    }
+    uint32_t length = readLittleEndian<uint32_t>(in.data() + inStart);
+    if (in.size() - inStart < 4 + length) {
+        fill(4 + length);
+    }
+    const char *frame = in.data() + inStart + 4;
+    inStart += 4 + length;
+    ServerOp op = pending.front();
+    pending.pop_front();
+
+    Response response;
+    response.status = static_cast<ServerStatus>(frame[0]);
+    if (response.status == ServerStatus::Ok && op == ServerOp::LookUp) {
+        response.value = readLittleEndian<uint64_t>(frame + 1);
+    } else if (response.status == ServerStatus::Ok && op == ServerOp::Scan) {
+        uint32_t count = readLittleEndian<uint32_t>(frame + 1);
+        for (uint32_t i = 0; i < count; i++) {
+            response.records.emplace_back(readLittleEndian<uint64_t>(frame + 5 + 16 * i),
+                                          readLittleEndian<uint64_t>(frame + 13 + 16 * i));
+        }
+    }
+    return response;
+}
+
+#endif
@@ -0,0 +1,601 @@
+#ifndef SHARDED_H
+#define SHARDED_H
+
+#include "btree.h"
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * Bounded lock free queue for many producers and one consumer (Vyukov's array queue). Each
+ * slot carries a sequence number telling producers and the consumer whose turn it is, so a
+ * push costs one compare and swap on the tail and a pop none at all.
+*/
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) : mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1), tail(0), head(0) {
+        slots = std::make_unique<Slot[]>(mask + 1);
+        for (size_t i = 0; i <= mask; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(const T &value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = slots[position & mask];
+            intptr_t lag = (intptr_t)slot.sequence.load(std::memory_order_acquire) - (intptr_t)position;
+            if (lag == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false; // full, the consumer has not freed this slot yet
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer only
+    bool tryPop(T &value) {
+        Slot &slot = slots[head & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        value = slot.value;
+        slot.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) size_t head;
+};
+
+/**
+ * Reader writer lock for the shard routing table. Readers register in one of many cache
+ * line sized slots, so threads routing requests at the same time do not write a shared line;
+ * the writer, a rebalance, raises a flag and waits for every slot to drain.
+*/
+class RoutingLock {
+public:
+    size_t lockShared() {
+        thread_local size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+        for (;;) {
+            slots[slot].readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!writing.load(std::memory_order_seq_cst)) {
+                return slot;
+            }
+            slots[slot].readers.fetch_sub(1, std::memory_order_release);
+            writing.wait(true);
+        }
+    }
+
+    void unlockShared(size_t slot) {
+        slots[slot].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() {
+        writerMutex.lock();
+        writing.store(true, std::memory_order_seq_cst);
+        for (Slot &slot : slots) {
+            while (slot.readers.load(std::memory_order_seq_cst)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock() {
+        writing.store(false, std::memory_order_seq_cst);
+        writing.notify_all();
+        writerMutex.unlock();
+    }
+
+private:
+    static constexpr size_t SLOTS = 64;
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> readers {0};
+    };
+
+    Slot slots[SLOTS];
+    alignas(64) std::atomic<bool> writing {false};
+    std::mutex writerMutex;
+    static inline std::atomic<size_t> nextSlot {0};
+};
+
+struct ShardOptions {
+    unsigned shards = 0;         // 0 for one per core
+    bool pinWorkers = true;      // worker i runs on core i modulo the core count
+    size_t queueCapacity = 4096; // requests per shard before producers wait
+    // how often the balancer checks the shards, 0 leaves rebalancing to explicit calls
+    std::chrono::milliseconds rebalanceInterval = std::chrono::milliseconds(50);
+    double imbalance = 1.5;      // rebalance once a shard holds or serves this multiple of the mean
+    size_t minShardSize = 4096;  // below this many records or requests per shard nothing moves
+};
+
+struct ShardStats {
+    uint64_t lowerBound; // smallest key routed to the shard
+    uint64_t records, requests; // requests since the last rebalance
+};
+
+/**
+ * Key range partitioned front end over one BTree per shard. Every shard is owned by a
+ * worker thread, pinned to a core, that alone touches its tree; callers route each request
+ * by key to the owning shard's MpscQueue. Nothing is shared between shards, so inserts into
+ * different ranges scale with the number of cores.
+ *
+ * insert is asynchronous: it returns once the request is queued. Requests from one thread to
+ * one key are applied in order, so a later lookUp sees an earlier insert; sync() waits until
+ * everything queued so far is applied. lookUp, remove and scan wait for their result, scans
+ * fan out to every shard their range touches and are concatenated in key order.
+ *
+ * Boundaries start evenly spread over the key type (bulkLoad places them at quantiles) and
+ * move when one shard grows past imbalance times the mean size or request count: a rebalance
+ * stops routing, drains every queue, moves the boundaries so that size and recent traffic are
+ * spread evenly, and migrates only the records that change shards.
+*/
+template <typename Key = uint64_t,
+          typename Value = uint64_t,
+          size_t LeafCap = pageFanout<Key, Value>(),
+          size_t InnerCap = pageFanout<InternalRecord<Key>>()>
+class ShardedBTree {
+public:
+    typedef BTree<Key, Value, LeafCap, InnerCap> Tree;
+    typedef typename Tree::RecordType RecordType;
+    static_assert(std::is_integral_v<Key>, "shard boundaries are spread over an integral key range");
+
+    explicit ShardedBTree(ShardOptions options = ShardOptions());
+    ~ShardedBTree();
+    ShardedBTree(const ShardedBTree&) = delete;
+    ShardedBTree& operator=(const ShardedBTree&) = delete;
+
+    void insert(RecordType record);
+    bool remove(Key key); // false when key is not in the tree
+    std::optional<Value> lookUp(Key key);
+    std::vector<RecordType> scan(Key lo, Key hi, size_t limit = SIZE_MAX);
+    void sync();
+
+    /**
+     * Replace the contents with records, sorted here if they are not, split into equal slices
+     * at key boundaries; every worker builds its own slice.
+    */
+    void bulkLoad(std::vector<RecordType> &records);
+
+    uint64_t size();                  // after sync()
+    bool rebalance();                 // false when the boundaries stayed where they were
+    bool maybeRebalance();            // rebalance if a shard is over the imbalance threshold
+    std::vector<ShardStats> stats();  // approximate while requests are in flight
+    inline size_t shardCount() const { return shards.size(); }
+
+private:
+    enum class Op : uint8_t { Insert, Remove, LookUp, Scan, BulkLoad, Barrier, Stop };
+
+    /**
+     * Where a waiting caller gets its answer. The worker fills in the result and raises done.
+    */
+    struct Completion {
+        std::atomic<bool> done {false};
+        std::optional<Value> value;
+        bool removed = false;
+        std::vector<RecordType> records;
+
+        void wait() {
+            for (int spins = 0; !done.load(std::memory_order_acquire); spins++) {
+                if (spins > 1000) {
+                    done.wait(false, std::memory_order_acquire);
+                }
+            }
+        }
+        void signal() {
+            done.store(true, std::memory_order_release);
+            done.notify_one();
+        }
+    };
+
+    struct Request {
+        Op op;
+        RecordType record {Key()};
+        Key hi {};
+        size_t limit = 0;
+        RecordType *records = nullptr; // BulkLoad slice
+        size_t count = 0;
+        Completion *completion = nullptr;
+    };
+
+    struct alignas(64) Shard {
+        explicit Shard(size_t queueCapacity) : queue(queueCapacity) {}
+
+        MpscQueue<Request> queue;
+        Tree tree;
+        std::thread worker;
+        alignas(64) std::atomic<bool> sleeping {false};
+        std::atomic<uint64_t> records {0}, requests {0}; // written by the worker only
+    };
+
+    ShardOptions options;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<Key> lowerBounds; // of each shard, guarded by routing
+    RoutingLock routing;
+
+    std::mutex balancerMutex;
+    std::condition_variable balancerWake;
+    bool stopping = false;
+    std::thread balancer;
+
+    size_t route(Key key) const;
+    void submit(size_t shard, const Request &request);
+    void work(Shard &shard);
+    void barrier();
+    Key keyAtRank(Tree &tree, uint64_t rank);
+};
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+ShardedBTree<Key, Value, LeafCap, InnerCap>::ShardedBTree(ShardOptions shardOptions) : options(shardOptions) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t count = options.shards ? options.shards : cores;
+    typedef std::make_unsigned_t<Key> Unsigned;
+    Unsigned span = Unsigned(std::numeric_limits<Key>::max()) - Unsigned(std::numeric_limits<Key>::min());
+    for (size_t i = 0; i < count; i++) {
+        shards.push_back(std::make_unique<Shard>(options.queueCapacity));
+        lowerBounds.push_back(Key(Unsigned(std::numeric_limits<Key>::min()) + span / count * i));
+    }
+    for (size_t i = 0; i < count; i++) {
+        Shard &shard = *shards[i];
+        shard.worker = std::thread([this, &shard] { work(shard); });
+        if (options.pinWorkers) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(shard.worker.native_handle(), sizeof(cpus), &cpus); // best effort
+        }
+    }
+    if (options.rebalanceInterval.count() > 0) {
+        balancer = std::thread([this] {
+            std::unique_lock<std::mutex> guard(balancerMutex);
+            while (!balancerWake.wait_for(guard, options.rebalanceInterval, [this] { return stopping; })) {
+                guard.unlock();
+                maybeRebalance();
+                guard.lock();
+            }
+        });
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+ShardedBTree<Key, Value, LeafCap, InnerCap>::~ShardedBTree() {
+    if (balancer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(balancerMutex);
+            stopping = true;
+        }
+        balancerWake.notify_one();
+        balancer.join();
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        submit(i, Request {Op::Stop});
+    }
+    for (auto &shard : shards) {
+        shard->worker.join();
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+size_t ShardedBTree<Key, Value, LeafCap, InnerCap>::route(Key key) const {
+    return std::upper_bound(lowerBounds.begin() + 1, lowerBounds.end(), key) - lowerBounds.begin() - 1;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::submit(size_t index, const Request &request) {
+    Shard &shard = *shards[index];
+    while (!shard.queue.tryPush(request)) {
+        std::this_thread::yield(); // the worker is behind, let it catch up
+    }
+    // pairs with the fence in work() so either the worker sees the request or we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.sleeping.load(std::memory_order_relaxed)) {
+        shard.sleeping.store(false, std::memory_order_relaxed);
+        shard.sleeping.notify_one();
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::work(Shard &shard) {
+    Request request;
+    for (;;) {
+        for (int spins = 0; !shard.queue.tryPop(request); spins++) {
+            if (spins < 256) {
+                continue;
+            }
+            shard.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (shard.queue.tryPop(request)) {
+                shard.sleeping.store(false, std::memory_order_relaxed);
+                break;
+            }
+            shard.sleeping.wait(true);
+            spins = 0;
+        }
+
+        Completion *completion = request.completion;
+        switch (request.op) {
+            case Op::Insert:
+                shard.tree.insert(request.record);
+                break;
+            case Op::Remove:
+                completion->removed = shard.tree.remove(request.record.key);
+                break;
+            case Op::LookUp:
+                completion->value = shard.tree.lookUp(request.record.key);
+                break;
+            case Op::Scan:
+                for (auto cursor = shard.tree.scan(request.record.key, request.hi);
+                     cursor.valid() && completion->records.size() < request.limit; cursor.next()) {
+                    completion->records.push_back(cursor.record());
+                }
+                break;
+            case Op::BulkLoad:
+                shard.tree.bulkLoad(request.records, request.records + request.count);
+                break;
+            case Op::Barrier:
+                break;
+            case Op::Stop:
+                return;
+        }
+        shard.records.store(shard.tree.capacity, std::memory_order_relaxed);
+        shard.requests.store(shard.requests.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (completion) {
+            completion->signal();
+        }
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::insert(RecordType record) {
+    size_t slot = routing.lockShared();
+    submit(route(record.key), Request {Op::Insert, record});
+    routing.unlockShared(slot);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool ShardedBTree<Key, Value, LeafCap, InnerCap>::remove(Key key) {
+    Completion completion;
+    size_t slot = routing.lockShared();
+    submit(route(key), Request {Op::Remove, RecordType {key}, Key(), 0, nullptr, 0, &completion});
+    routing.unlockShared(slot);
+    completion.wait();
+    return completion.removed;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::optional<Value> ShardedBTree<Key, Value, LeafCap, InnerCap>::lookUp(Key key) {
+    Completion completion;
+    size_t slot = routing.lockShared();
+    submit(route(key), Request {Op::LookUp, RecordType {key}, Key(), 0, nullptr, 0, &completion});
+    routing.unlockShared(slot);
+    completion.wait();
+    return completion.value;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::vector<typename ShardedBTree<Key, Value, LeafCap, InnerCap>::RecordType>
+ShardedBTree<Key, Value, LeafCap, InnerCap>::scan(Key lo, Key hi, size_t limit) {
+    if (hi < lo || limit == 0) {
+        return {};
+    }
+    size_t slot = routing.lockShared();
+    size_t first = route(lo), last = route(hi);
+    std::vector<Completion> parts(last - first + 1);
+    for (size_t i = first; i <= last; i++) {
+        submit(i, Request {Op::Scan, RecordType {lo}, hi, limit, nullptr, 0, &parts[i - first]});
+    }
+    routing.unlockShared(slot);
+
+    // the shards own disjoint ascending ranges, so merging is concatenating in shard order
+    std::vector<RecordType> records;
+    for (Completion &part : parts) {
+        part.wait();
+        size_t take = std::min(part.records.size(), limit - records.size());
+        records.insert(records.end(), part.records.begin(), part.records.begin() + take);
+    }
+    return records;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::barrier() {
+    std::vector<Completion> drained(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        submit(i, Request {Op::Barrier, RecordType {Key()}, Key(), 0, nullptr, 0, &drained[i]});
+    }
+    for (Completion &completion : drained) {
+        completion.wait();
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::sync() {
+    size_t slot = routing.lockShared();
+    routing.unlockShared(slot); // waits out a rebalance in progress
+    barrier();
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+uint64_t ShardedBTree<Key, Value, LeafCap, InnerCap>::size() {
+    sync();
+    uint64_t total = 0;
+    for (auto &shard : shards) {
+        total += shard->records.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::vector<ShardStats> ShardedBTree<Key, Value, LeafCap, InnerCap>::stats() {
+    std::vector<ShardStats> result;
+    size_t slot = routing.lockShared();
+    for (size_t i = 0; i < shards.size(); i++) {
+        result.push_back({(uint64_t)lowerBounds[i], shards[i]->records.load(std::memory_order_relaxed),
+                          shards[i]->requests.load(std::memory_order_relaxed)});
+    }
+    routing.unlockShared(slot);
+    return result;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void ShardedBTree<Key, Value, LeafCap, InnerCap>::bulkLoad(std::vector<RecordType> &records) {
+    if (!std::is_sorted(records.begin(), records.end())) {
+        parallelSort(records, shards.size());
+    }
+    // slices cut at key boundaries, a run of equal keys never straddles two of them
+    std::vector<std::pair<size_t, size_t>> slices;
+    for (size_t i = 0; i < shards.size(); i++) {
+        size_t begin = packedNodeOffset(records.size(), shards.size(), i);
+        size_t end = begin + packedNodeSize(records.size(), shards.size(), i);
+        while (i > 0 && begin > 0 && begin < records.size() && records[begin - 1].key == records[begin].key) {
+            begin++;
+        }
+        while (end < records.size() && end > 0 && records[end - 1].key == records[end].key) {
+            end++;
+        }
+        if (begin < end) {
+            slices.push_back({begin, end});
+        }
+    }
+
+    // Slices that came out empty (fewer records than shards, long runs of equal keys) go to
+    // the first shards. Their lower bounds equal the one after them and route() picks the
+    // last of equal bounds, so they own no keys until a rebalance hands them a range.
+    size_t empty = shards.size() - slices.size();
+    routing.lock();
+    barrier();
+    std::vector<Completion> loaded(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::pair<size_t, size_t> slice = i < empty ? std::make_pair<size_t, size_t>(0, 0) : slices[i - empty];
+        if (i > 0) {
+            lowerBounds[i] = i <= empty ? lowerBounds[0] : records[slice.first].key;
+        }
+        submit(i, Request {Op::BulkLoad, RecordType {Key()}, Key(), 0, records.data() + slice.first, slice.second - slice.first, &loaded[i]});
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        loaded[i].wait();
+        shards[i]->requests.store(0, std::memory_order_relaxed);
+    }
+    routing.unlock();
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+Key ShardedBTree<Key, Value, LeafCap, InnerCap>::keyAtRank(Tree &tree, uint64_t rank) {
+    for (typename Tree::Leaf *leafNode = tree.leftmostLeaf();;) {
+        if (rank < leafNode->size() || leafNode->nextLeaf == NULL_HANDLE) {
+            return leafNode->key(std::min<uint64_t>(rank, leafNode->size() - 1));
+        }
+        rank -= leafNode->size();
+        leafNode = tree.arena.leaf(leafNode->nextLeaf);
+    }
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool ShardedBTree<Key, Value, LeafCap, InnerCap>::rebalance() {
+    routing.lock();
+    barrier(); // the workers are idle from here until unlock, their trees are ours
+
+    // every shard weighs its share of the records plus its share of the recent requests,
+    // spread evenly over its records; the new cuts split the total weight in equal parts
+    size_t count = shards.size();
+    double records = 0, requests = 0;
+    for (auto &shard : shards) {
+        records += shard->tree.capacity;
+        requests += shard->requests.load(std::memory_order_relaxed);
+    }
+    std::vector<double> weights;
+    for (auto &shard : shards) {
+        weights.push_back((records ? shard->tree.capacity / records : 0) +
+                          (requests ? shard->requests.load(std::memory_order_relaxed) / requests : 0));
+    }
+    double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+    std::vector<Key> bounds = lowerBounds;
+    double before = 0;
+    for (size_t i = 0, cut = 1; i < count && cut < count && total > 0; i++) {
+        uint64_t size = shards[i]->tree.capacity;
+        while (cut < count && before + weights[i] >= total * cut / count) {
+            double fraction = weights[i] ? std::max(0.0, total * cut / count - before) / weights[i] : 0;
+            Key key = size ? keyAtRank(shards[i]->tree, std::min<uint64_t>(size - 1, fraction * size)) : lowerBounds[i];
+            bounds[cut] = std::max(bounds[cut - 1], key);
+            cut++;
+        }
+        before += weights[i];
+    }
+
+    bool moved = bounds != lowerBounds;
+    if (moved) {
+        // pull out only the records that fall outside their shard's new range
+        std::vector<std::vector<RecordType>> incoming(count);
+        for (size_t i = 0; i < count; i++) {
+            Tree &tree = shards[i]->tree;
+            std::vector<RecordType> leaving;
+            if (i > 0 && bounds[i] > std::numeric_limits<Key>::min()) {
+                for (auto cursor = tree.scan(std::numeric_limits<Key>::min(), bounds[i] - 1); cursor.valid(); cursor.next()) {
+                    leaving.push_back(cursor.record());
+                }
+            }
+            if (i + 1 < count) {
+                for (auto cursor = tree.scan(bounds[i + 1], std::numeric_limits<Key>::max()); cursor.valid(); cursor.next()) {
+                    leaving.push_back(cursor.record());
+                }
+            }
+            for (const RecordType &record : leaving) {
+                tree.remove(record.key);
+                size_t target = std::upper_bound(bounds.begin() + 1, bounds.end(), record.key) - bounds.begin() - 1;
+                incoming[target].push_back(record);
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (!incoming[i].empty()) {
+                shards[i]->tree.insertBatch(incoming[i]);
+            }
+        }
+        lowerBounds = bounds;
+    }
+    for (auto &shard : shards) {
+        shard->records.store(shard->tree.capacity, std::memory_order_relaxed);
+        shard->requests.store(0, std::memory_order_relaxed);
+    }
+    routing.unlock();
+    return moved;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+bool ShardedBTree<Key, Value, LeafCap, InnerCap>::maybeRebalance() {
+    uint64_t records = 0, requests = 0, maxRecords = 0, maxRequests = 0;
+    for (auto &shard : shards) {
+        uint64_t size = shard->records.load(std::memory_order_relaxed);
+        uint64_t served = shard->requests.load(std::memory_order_relaxed);
+        records += size;
+        requests += served;
+        maxRecords = std::max(maxRecords, size);
+        maxRequests = std::max(maxRequests, served);
+    }
+    double count = shards.size();
+    bool large = maxRecords >= options.minShardSize && maxRecords > options.imbalance * records / count;
+    bool hot = requests >= options.minShardSize * count && maxRequests > options.imbalance * requests / count;
+    return (large || hot) && rebalance();
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "btree.h"
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+/**
+ * Streaming binary snapshot written by BTree::save and read by BTree::load. After the
+ * header comes one block per leaf in key order: a block header, the keys, then the values.
+ * Internal nodes are not stored, load rebuilds them bottom up from the leaves in one pass.
+ * Every block and the header carry a checksum so truncated or corrupted snapshots are
+ * rejected instead of producing a broken tree.
+*/
+#define SNAPSHOT_MAGIC "BTREESN"
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t keySize, valueSize;
+    uint32_t reserved;
+    uint64_t recordCount;
+    uint64_t blockCount;
+    uint64_t checksum; // of the fields above
+};
+
+struct SnapshotBlockHeader {
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t checksum; // of the keys and values that follow
+};
+
+/**
+ * Word at a time multiply-rotate hash, cheap enough to keep up with sequential I/O.
+*/
+inline uint64_t snapshotChecksum(const void *data, size_t bytes, uint64_t seed = 0x9E3779B97F4A7C15ull) {
+    const unsigned char *in = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed ^ bytes;
+    for (; bytes >= 8; in += 8, bytes -= 8) {
+        uint64_t word;
+        std::memcpy(&word, in, 8);
+        hash = (hash ^ (word * 0xC2B2AE3D27D4EB4Full));
+        hash = ((hash << 31) | (hash >> 33)) * 0x9E3779B97F4A7C15ull;
+    }
+    for (; bytes; in++, bytes--) {
+        hash = (hash ^ *in) * 0x100000001B3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::save(std::ostream &out) {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "snapshots store keys and values as raw bytes");
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.formatVersion = SNAPSHOT_VERSION;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    for (Leaf *leafNode = leftmostLeaf();;) {
+        if (leafNode->size()) {
+            header.recordCount += leafNode->size();
+            header.blockCount++;
+        }
+        if (leafNode->nextLeaf == NULL_HANDLE) {
+            break;
+        }
+        leafNode = arena.leaf(leafNode->nextLeaf);
+    }
+    header.checksum = snapshotChecksum(&header, offsetof(SnapshotHeader, checksum));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // one buffer for the whole block so it goes out in a single write
+    std::vector<char> block;
+    for (Leaf *leafNode = leftmostLeaf();;) {
+        size_t count = leafNode->size();
+        if (count) {
+            // the block layout matches the leaf, both arrays go out in one copy each (or one
+            // decode each for a packed leaf)
+            block.resize(sizeof(SnapshotBlockHeader) + count * (sizeof(Key) + sizeof(Value)));
+            char *keys = block.data() + sizeof(SnapshotBlockHeader);
+            char *values = keys + count * sizeof(Key);
+            leafNode->copyTo(reinterpret_cast<Key*>(keys), reinterpret_cast<Value*>(values));
+            SnapshotBlockHeader blockHeader = {};
+            blockHeader.count = count;
+            blockHeader.checksum = snapshotChecksum(keys, block.size() - sizeof(SnapshotBlockHeader));
+            std::memcpy(block.data(), &blockHeader, sizeof(blockHeader));
+            out.write(block.data(), block.size());
+        }
+        if (leafNode->nextLeaf == NULL_HANDLE) {
+            break;
+        }
+        leafNode = arena.leaf(leafNode->nextLeaf);
+    }
+    if (!out) {
+        throw std::runtime_error("failed writing snapshot");
+    }
+}
+
+/**
+ * Blocks larger than LeafCap (a snapshot of a wider tree) are spread evenly over as many
+ * leaves as needed. On error the tree is left empty.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::load(std::istream &in) {
+    clearNodes();
+    capacity = 0;
+    rootNode = arena.newLeaf();
+    auto fail = [this](const std::string &problem) {
+        clearNodes();
+        rootNode = arena.newLeaf();
+        throw std::runtime_error("snapshot " + problem);
+    };
+
+    SnapshotHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        fail("has no valid header");
+    }
+    if (header.checksum != snapshotChecksum(&header, offsetof(SnapshotHeader, checksum))) {
+        fail("header checksum mismatch");
+    }
+    if (header.formatVersion != SNAPSHOT_VERSION || header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+        fail("was written for a different format version or key and value types");
+    }
+    if (header.recordCount == 0) {
+        return;
+    }
+
+    std::vector<LevelEntry> level;
+    level.reserve(packedNodeCount(header.recordCount, LeafCap));
+    std::vector<char> block;
+    PlainLeaf *prevLeaf = nullptr;
+    uint64_t loaded = 0;
+    for (uint64_t b = 0; b < header.blockCount; b++) {
+        SnapshotBlockHeader blockHeader;
+        if (!in.read(reinterpret_cast<char*>(&blockHeader), sizeof(blockHeader)) || blockHeader.count == 0) {
+            fail("is truncated");
+        }
+        size_t count = blockHeader.count;
+        if (count > header.recordCount - loaded) {
+            fail("record count does not match its header"); // the block count has no checksum of its own
+        }
+        block.resize(count * (sizeof(Key) + sizeof(Value)));
+        if (!in.read(block.data(), block.size())) {
+            fail("is truncated");
+        }
+        if (blockHeader.checksum != snapshotChecksum(block.data(), block.size())) {
+            fail("block checksum mismatch");
+        }
+        const char *keys = block.data();
+        const char *values = keys + count * sizeof(Key);
+
+        size_t numLeaves = packedNodeCount(count, LeafCap);
+        size_t next = 0;
+        for (size_t i = 0; i < numLeaves; i++) {
+            NodeHandle handle = prevLeaf ? arena.newLeaf() : rootNode;
+            PlainLeaf *leaf = arena.plainLeaf(handle);
+            size_t leafCount = packedNodeSize(count, numLeaves, i);
+            leaf->keys.resize(leafCount);
+            leaf->values.resize(leafCount);
+            std::memcpy(leaf->keys.data(), keys + next * sizeof(Key), leafCount * sizeof(Key));
+            std::memcpy(leaf->values.data(), values + next * sizeof(Value), leafCount * sizeof(Value));
+            next += leafCount;
+            for (size_t j = 0; j < leafCount; j++) {
+                if (j > 0 ? !(leaf->keys[j - 1] < leaf->keys[j])
+                          : prevLeaf && !(prevLeaf->keys.back() < leaf->keys[j])) {
+                    fail("keys are not in ascending order");
+                }
+            }
+            leaf->curCap = leafCount;
+            if (prevLeaf) {
+                prevLeaf->nextLeaf = handle;
+                leaf->prevLeaf = prevLeaf->id;
+            }
+            prevLeaf = leaf;
+            level.push_back({leaf->keys.front(), handle});
+        }
+        loaded += count;
+    }
+    if (loaded != header.recordCount) {
+        fail("record count does not match its header");
+    }
+    capacity = loaded;
+    buildInternalLevels(level, 1.0);
+}
+
+#endif
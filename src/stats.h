@@ -0,0 +1,239 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Counters on the hot paths of the tree, compiled in only when BTREE_STATS is defined
+ * (make STATS=1). Otherwise BTREE_STAT expands to nothing and the paths are unchanged.
+ *
+ * Each thread counts into its own block with plain relaxed stores, so counting never
+ * bounces a cache line between threads; StatsRegistry sums the blocks when asked. Counts
+ * are process wide, not per tree.
+*/
+enum class Stat : size_t {
+    Inserts,
+    Lookups,
+    Removes,
+    Appends,        // inserts past the last key that took the rightmost leaf hint, no descent
+    Descents,       // root to leaf passes
+    NodesVisited,   // nodes on those passes, the leaf included
+    LeafSplits,
+    InternalSplits,
+    PushUps,        // InternalNode::pushUp calls of the serial insert
+    PushUpCascades, // pushUps that had to split a full parent first
+    RootSplits,     // the tree grew a level
+    RootCollapses,  // the tree lost a level
+    LeafMerges,
+    InternalMerges,
+    Borrows,
+    Restarts,       // optimistic descents of ConcurrentBTree that started over
+    Count
+};
+
+inline constexpr const char *statNames[] = {
+    "inserts", "lookups", "removes", "appends", "descents", "nodes_visited", "leaf_splits", "internal_splits",
+    "push_ups", "push_up_cascades", "root_splits", "root_collapses", "leaf_merges", "internal_merges",
+    "borrows", "restarts",
+};
+static_assert(sizeof(statNames) / sizeof(statNames[0]) == static_cast<size_t>(Stat::Count));
+
+typedef std::array<uint64_t, static_cast<size_t>(Stat::Count)> StatCounts;
+
+#ifdef BTREE_STATS
+inline constexpr bool statsEnabled = true;
+#define BTREE_STAT(stat, n) threadStats().add(Stat::stat, n)
+#else
+inline constexpr bool statsEnabled = false;
+#define BTREE_STAT(stat, n) ((void)0)
+#endif
+
+class ThreadStats {
+public:
+    ThreadStats();
+    ~ThreadStats();
+
+    // only the owning thread writes, so a load and a store is enough and cheaper than fetch_add
+    inline void add(Stat stat, uint64_t n) {
+        std::atomic<uint64_t> &count = counts[static_cast<size_t>(stat)];
+        count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void addTo(StatCounts &total) const {
+        for (size_t i = 0; i < total.size(); i++) {
+            total[i] += counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (auto &count : counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Stat::Count)> counts {};
+};
+
+/**
+ * Every live ThreadStats block plus the totals of threads that already exited.
+ * reset() is meant for quiescent points; a count racing with it may survive.
+*/
+class StatsRegistry {
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    void attach(ThreadStats *stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(stats);
+    }
+
+    void detach(ThreadStats *stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats->addTo(retired);
+        threads.erase(std::find(threads.begin(), threads.end(), stats));
+    }
+
+    StatCounts aggregate() {
+        std::lock_guard<std::mutex> lock(mutex);
+        StatCounts total = retired;
+        for (const ThreadStats *stats : threads) {
+            stats->addTo(total);
+        }
+        return total;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.fill(0);
+        for (ThreadStats *stats : threads) {
+            stats->reset();
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<ThreadStats*> threads;
+    StatCounts retired {};
+};
+
+inline ThreadStats::ThreadStats() {
+    StatsRegistry::instance().attach(this);
+}
+
+inline ThreadStats::~ThreadStats() {
+    StatsRegistry::instance().detach(this);
+}
+
+inline ThreadStats& threadStats() {
+    thread_local ThreadStats stats;
+    return stats;
+}
+
+/**
+ * Operation counts together with the shape of one tree, see BTree::stats.
+*/
+struct TreeStats {
+    StatCounts operations;
+    size_t height, leaves, internalNodes, records;
+    double leafFill, internalFill; // share of the capacity in use, averaged over the level
+    size_t bytesInUse, bytesReserved; // NodeArena::bytesInUse and bytesReserved
+};
+
+struct HardwareCounts {
+    uint64_t cycles, instructions, cacheMisses, branchMisses;
+};
+
+/**
+ * Cycles, instructions, cache misses and branch misses of the calling thread, read through
+ * perf_event_open as one group so all four cover the same intervals. Counting starts and
+ * stops with syscalls, wrap whole loops rather than single operations. available() is false
+ * when the kernel refuses the events (perf_event_paranoid, containers, virtual machines);
+ * start and stop then do nothing.
+*/
+class HardwareCounters {
+public:
+    HardwareCounters() : totals {} {
+        const uint64_t events[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (size_t i = 0; i < EVENT_COUNT; i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = events[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0) {
+                closeAll(i);
+                return;
+            }
+        }
+    }
+
+    ~HardwareCounters() {
+        if (available()) {
+            closeAll(EVENT_COUNT);
+        }
+    }
+
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    inline bool available() const { return fds[0] >= 0; }
+
+    void start() {
+        if (available()) {
+            ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void stop() {
+        if (!available()) {
+            return;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t group[1 + EVENT_COUNT];
+        if (::read(fds[0], group, sizeof(group)) == sizeof(group)) {
+            totals.cycles += group[1];
+            totals.instructions += group[2];
+            totals.cacheMisses += group[3];
+            totals.branchMisses += group[4];
+        }
+    }
+
+    // summed over every start / stop interval so far
+    inline HardwareCounts read() const { return totals; }
+    inline void reset() { totals = HardwareCounts {}; }
+
+private:
+    static constexpr size_t EVENT_COUNT = 4;
+    int fds[EVENT_COUNT];
+    HardwareCounts totals;
+
+    void closeAll(size_t opened) {
+        for (size_t i = 0; i < opened; i++) {
+            close(fds[i]);
+        }
+        fds[0] = -1;
+    }
+};
+
+#endif
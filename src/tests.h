@@ -2,27 +2,188 @@
 #define TESTS_H
 
 #include "btree.h"
+#include "concurrent.h"
+#include "wal.h"
+#include "loader.h"
+#include "server.h"
+#include "sharded.h"
 /**
  * Fails when insertion can not complete. Correctness of insertion validated in later tests. 
 */
-bool testInsert(const std::unique_ptr<BTree> &tree, int numIndicies, std::ifstream &file);
+template <typename Tree>
+bool testInsert(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file);
 
 /**
  * Assert that each index we inserted into the tree can be found by searching from the
- * root of the tree.
+ * root of the tree, together with the value it was inserted with.
 */
-bool testLookUp(const std::unique_ptr<BTree> &tree, int numIndicies, std::ifstream &file);
+template <typename Tree>
+bool testLookUp(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * multiGet over every index in random order, plus some that were never inserted, must
+ * agree with lookUp key by key.
+*/
+template <typename Tree>
+bool testMultiGet(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Fails when the file can not be parsed. Builds the tree in one bulkLoad call instead of
+ * one insert per line, the resulting tree is checked by the same lookup and leaf chain tests.
+*/
+template <typename Tree>
+bool testBulkLoad(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, double fillFactor = 1.0);
+
+/**
+ * Fails when the file can not be parsed. Builds the tree with bulkLoadParallel on threads
+ * threads from the records in file order, so the parallel sort runs as well as the packing.
+*/
+template <typename Tree>
+bool testBulkLoadParallel(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, unsigned threads);
+
+/**
+ * Fails when the file can not be parsed. Inserts the file through insertBatch in batches of
+ * batchSize records, the resulting tree is checked by the same lookup and leaf chain tests.
+*/
+template <typename Tree>
+bool testInsertBatch(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, size_t batchSize);
 
 /*
  * Every index inserted into a B+ Tree is unique. Regardless of order,
  * once N insertions are made the indicices in adjacent leaf nodes should
  * be monotonically increasing. This is what makes B+ Trees good for range queries.
 */
-bool testLeafChain(const std::unique_ptr<BTree> &tree);
+template <typename Tree>
+bool testLeafChain(const std::unique_ptr<Tree> &tree);
+
+/**
+ * Bounded scans over random ranges, forwards with scan() and backwards with scanReverse(),
+ * must yield exactly the inserted indices inside the range in order.
+*/
+template <typename Tree>
+bool testRangeScan(const std::unique_ptr<Tree> &tree, int numIndicies);
 
-/** 
- * TODO: actually implement remove...
+/**
+ * Write the filled tree to a page file and open it mapped. The mapping must find every
+ * inserted index with its value, report the same capacity and pass the range scan test on
+ * its own. A page count past the end of the file, an entry count beyond a page's
+ * capacity and a child or leaf link outside the file must be refused.
+*/
+template <typename Tree>
+bool testMappedPages(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Freeze the filled tree. The frozen copy must report the same capacity, find every inserted
+ * index with its value through lookUp and multiGet, miss the rest and scan random ranges
+ * exactly like the tree.
 */
-bool testRemove(const std::unique_ptr<BTree> &tree);
+template <typename Tree>
+bool testFreeze(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Save the filled tree to a snapshot and load it into a fresh tree, which must find every
+ * inserted index with its value and keep its leaf chain. The same snapshot with one flipped byte must be
+ * rejected, in the records or in a block's record count.
+*/
+template <typename Tree>
+bool testSnapshot(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Read a snapshot of the filled tree on another thread while this one inserts, updates and
+ * removes around every leaf. The view must keep returning exactly the records it was taken
+ * on, and the tree must be back to them once the writes are undone.
+*/
+template <typename Tree>
+bool testSnapshotView(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Serve the filled tree over a Unix socket and a TCP port. Pipelined lookups of every index
+ * must return their values in order, scans, inserts and removes must round trip, and a
+ * malformed request must be answered with an error without losing the connection. With a
+ * write-ahead log, writes must be on disk by the time they are answered. The tree holds the
+ * same records afterwards.
+*/
+template <typename Tree>
+bool testServer(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * The indices in random order written as a text and as a binary key file must read back
+ * unchanged through readKeyFile on one and on several threads, and a truncated binary file
+ * must be rejected.
+*/
+bool testKeyFile(int numIndicies);
+
+/**
+ * Log every record of the filled tree, tear the last record as a crash mid write would, and
+ * replay the log into a fresh tree. The replayed tree must hold every inserted index with
+ * its value and the torn record must be cut off.
+*/
+template <typename Tree>
+bool testWriteAheadLog(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Insert the second half of the file from several writer threads while reader threads keep
+ * looking up the first half, which was inserted up front and must never go missing or show
+ * another value. Every index must be found and the leaf chain intact once all threads are done.
+*/
+template <typename Tree>
+bool testConcurrentAccess(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, int numThreads);
+
+/**
+ * Insert the file into a ShardedBTree of numThreads shards from as many threads. After sync
+ * every index must be found and a full scan must return them in order across the shards.
+ * All keys start in the first shard, so a rebalance must spread them evenly, without losing
+ * any, and removes must reach the shard that holds the key afterwards. Bulk loads of fewer
+ * records than shards, of a run of equal keys and of nothing must keep every key reachable.
+*/
+bool testShardedTree(int numIndicies, std::ifstream &file, int numThreads);
+
+/**
+ * Every SIMD search path the cpu supports must agree with the scalar lower and upper
+ * bound on random sorted arrays, including duplicates, empty arrays and ragged tails, for
+ * uint64_t keys and the 8, 16 and 32 bit offsets of packed leaves.
+*/
+bool testNodeSearch();
+
+/**
+ * Freeze a tree of uniformly spread keys and one whose keys crowd at both ends of their
+ * range. Most segments of the first must be fitted, some of the second must fall back to
+ * the fences, and both must find every key and miss its neighbours through lookUp and
+ * multiGet, with and without the model.
+*/
+bool testFrozenModel(int numIndicies);
+
+/**
+ * Fill a narrow tree in random order and check BTree::stats against its shape: one leaf
+ * split per leaf beyond the first, one internal split or root split per internal node, and
+ * every lookup visiting exactly height nodes. Without BTREE_STATS every count must be zero.
+*/
+bool testStats(int numIndicies);
+
+/**
+ * Insert the indices in ascending order, holding every tenth back until the end, into a
+ * narrow and a page sized tree. The appends must leave the leaves at least three quarters
+ * full, and once the held back keys are in every index must be found. The upper quarter is
+ * then removed and appended again, partly while a view shares the rightmost leaves.
+*/
+bool testAppend(int numIndicies);
+
+/**
+ * Compress the filled tree. It must take fewer bytes than before and still find every index
+ * with its value, scan in order and survive a snapshot round trip. An insert, update and
+ * remove on packed leaves must replace them by plain ones transparently. The tree is left compressed.
+*/
+template <typename Tree>
+bool testCompression(const std::unique_ptr<Tree> &tree, int numIndicies);
+
+/**
+ * Remove the indices of the file from the filled tree in file order, half first and then
+ * the rest. Removed indices must be gone and the others in place after each half; once
+ * empty the tree must have collapsed back to a single leaf and take the indices again.
+*/
+template <typename Tree>
+bool testRemove(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file);
+
+#include "tests.tpp"
 
 #endif
\ No newline at end of file
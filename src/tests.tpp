@@ -0,0 +1,1000 @@
+// Template definitions for tests.h, included at the end of that header.
+
+#include <random>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+/**
+ * Value stored with each index by the insert, bulk load and batch tests, so lookups can tell
+ * a key found with the wrong payload from a correct one.
+*/
+inline uint64_t valueOf(uint64_t index) {
+    return index * 10 + 7;
+}
+
+/**
+ * Read the indices of a test file from the line after the count to the end, skipping index 0
+ * as every test does. Returns false when a line can not be parsed.
+*/
+inline bool readIndices(std::ifstream &file, std::vector<uint64_t> &indices) {
+    try {
+        std::string line;
+        while (getline(file, line)) {
+            uint64_t index = static_cast<uint64_t>(std::stoul(line));
+            if (index) {
+                indices.push_back(index);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Fails when insertion can not complete. Correctness of insertion validated in later tests. 
+*/
+template <typename Tree>
+bool testInsert(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file) {
+
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    for (uint64_t index : indices) {
+        tree->insert(typename Tree::RecordType {index, valueOf(index)});
+    }
+    return true;     
+}
+
+/**
+ * Fails when the file can not be parsed. Builds the tree in one bulkLoad call instead of
+ * one insert per line, the resulting tree is checked by the same lookup and leaf chain tests.
+*/
+template <typename Tree>
+bool testBulkLoad(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, double fillFactor) {
+
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    std::vector<typename Tree::RecordType> records;
+    records.reserve(indices.size());
+    for (uint64_t index : indices) {
+        records.push_back(typename Tree::RecordType {index, valueOf(index)});
+    }
+    tree->bulkLoad(records.begin(), records.end(), fillFactor);
+    return tree->capacity == records.size();
+}
+
+/**
+ * Fails when the file can not be parsed. Builds the tree with bulkLoadParallel on threads
+ * threads from the records in file order, so the parallel sort runs as well as the packing.
+*/
+template <typename Tree>
+bool testBulkLoadParallel(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, unsigned threads) {
+
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    std::vector<typename Tree::RecordType> records;
+    records.reserve(indices.size());
+    for (uint64_t index : indices) {
+        records.push_back(typename Tree::RecordType {index, valueOf(index)});
+    }
+    tree->bulkLoadParallel(records, threads);
+    return tree->capacity == records.size() && std::is_sorted(records.begin(), records.end());
+}
+
+/**
+ * Fails when the file can not be parsed. Inserts the file through insertBatch in batches of
+ * batchSize records, the resulting tree is checked by the same lookup and leaf chain tests.
+*/
+template <typename Tree>
+bool testInsertBatch(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, size_t batchSize) {
+
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    std::vector<typename Tree::RecordType> batch;
+    batch.reserve(batchSize);
+    for (uint64_t index : indices) {
+        batch.push_back(typename Tree::RecordType {index, valueOf(index)});
+        if (batch.size() == batchSize) {
+            tree->insertBatch(batch);
+            batch.clear();
+        }
+    }
+    tree->insertBatch(batch);
+    return true;
+}
+
+/**
+ * Assert that each index we inserted into the tree can be found by searching from the
+ * root of the tree.
+*/
+template <typename Tree>
+bool testLookUp(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    for (int i =1; i < numIndicies; i++) {
+        if (tree->lookUp(i) != valueOf(i)) {
+            return false;
+        }
+    }
+    if (tree->lookUp(numIndicies++).has_value()) {
+        return false;
+    }
+
+    return true;    
+}
+
+template <typename Tree>
+bool testMultiGet(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::vector<uint64_t> keys(numIndicies + MULTIGET_GROUP + 1);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    std::vector<std::optional<uint64_t>> values(keys.size(), 0);
+    tree->multiGet(keys, values);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (values[i] != tree->lookUp(keys[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Every index inserted into a B+ Tree is unique. Regardless of order,
+ * once N insertions are made the indicices in adjacent leaf nodes should
+ * be monotonically increasing. This is what makes B+ Trees good for range queries.
+*/
+template <typename Tree>
+bool testLeafChain(const std::unique_ptr<Tree> &tree) {
+    /**
+     * TODO: implement this test
+     *
+     * */
+    typename Tree::Leaf *curLeafNode = tree->leftmostLeaf();
+
+    uint64_t prevKey = 0;
+    while (curLeafNode) {
+        for (size_t slot = 0; slot < curLeafNode->size(); slot++) {
+            if (curLeafNode->key(slot) != (prevKey + 1)) {
+                return false;
+            }
+            prevKey = curLeafNode->key(slot);
+        }
+        curLeafNode = curLeafNode->nextLeaf != NULL_HANDLE ? tree->arena.leaf(curLeafNode->nextLeaf) : nullptr;
+    }
+
+    return true;    
+}
+
+/**
+ * Bounded scans over random ranges, forwards with scan() and backwards with scanReverse(),
+ * must yield exactly the inserted indices inside the range in order.
+*/
+template <typename Tree>
+bool testRangeScan(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::mt19937_64 rng(7);
+    for (int i = 0; i < 200; i++) {
+        uint64_t lo = rng() % (numIndicies + 2);
+        uint64_t hi = lo + rng() % (numIndicies / 4 + 2);
+        uint64_t first = std::max<uint64_t>(lo, 1);
+        uint64_t last = std::min<uint64_t>(hi, numIndicies - 1);
+
+        uint64_t expected = first;
+        for (auto cursor = tree->scan(lo, hi); cursor.valid(); cursor.next()) {
+            if (cursor.key() != expected++) {
+                return false;
+            }
+        }
+        if (expected != (first <= last ? last + 1 : first)) {
+            return false;
+        }
+
+        expected = last;
+        for (auto cursor = tree->scanReverse(lo, hi); cursor.valid(); cursor.prev()) {
+            if (cursor.key() != expected--) {
+                return false;
+            }
+        }
+        if (expected != (first <= last ? first - 1 : last)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write the filled tree to a page file and open it mapped. The mapping must find every
+ * inserted index, report the same capacity and pass the range scan test on its own.
+*/
+template <typename Tree>
+bool testMappedPages(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::string path = (std::filesystem::temp_directory_path() / "btree-test.pages").string();
+    bool passed = true;
+    try {
+        tree->writePages(path);
+        auto mapped = std::make_unique<decltype(Tree::openMapped(path))>(Tree::openMapped(path));
+        passed = mapped->capacity == tree->capacity && !mapped->lookUp(numIndicies).has_value();
+        for (int i = 1; passed && i < numIndicies; i++) {
+            passed = mapped->lookUp(i).has_value() && mapped->lookUp(i) == tree->lookUp(i);
+        }
+        passed = passed && testRangeScan(mapped, numIndicies);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        passed = false;
+    }
+
+    // overwrite one field of the file and expect opening it or scanning it all to be refused
+    auto rejects = [&](size_t offset, uint64_t value, size_t bytes) {
+        tree->writePages(path);
+        {
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(offset);
+            file.write(reinterpret_cast<const char*>(&value), bytes);
+        }
+        try {
+            auto mapped = Tree::openMapped(path);
+            for (auto cursor = mapped.scan(0, UINT64_MAX); cursor.valid(); cursor.next()) {
+            }
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    try {
+        tree->writePages(path);
+        PageFileHeader header;
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(&header), sizeof(header));
+        size_t root = (size_t)header.rootPage * DEFAULT_PAGE_SIZE;
+        size_t firstChild = root + PageLayout<uint64_t, uint64_t>::childrenOffset;
+        passed &= rejects(offsetof(PageFileHeader, pageCount), uint64_t(1) << 60, sizeof(uint64_t));
+        passed &= rejects(root + offsetof(PageHeader, count), UINT16_MAX, sizeof(uint16_t));
+        passed &= rejects(header.height > 1 ? firstChild : root + offsetof(PageHeader, nextLeaf),
+                          header.pageCount, sizeof(PageNumber));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        passed = false;
+    }
+    std::filesystem::remove(path);
+    return passed;
+}
+
+template <typename Tree>
+bool testFreeze(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    auto frozen = tree->freeze();
+    if (frozen.capacity != tree->capacity || frozen.lookUp(numIndicies).has_value()) {
+        return false;
+    }
+    for (int i = 1; i < numIndicies; i++) {
+        if (!frozen.lookUp(i).has_value() || frozen.lookUp(i) != tree->lookUp(i)) {
+            return false;
+        }
+    }
+
+    std::vector<uint64_t> keys(numIndicies + MULTIGET_GROUP + 1);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    std::vector<std::optional<uint64_t>> values(keys.size(), 0);
+    frozen.multiGet(keys, values);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (values[i] != tree->lookUp(keys[i])) {
+            return false;
+        }
+    }
+
+    std::mt19937_64 rng(7);
+    for (int i = 0; i < 200; i++) {
+        uint64_t lo = rng() % (numIndicies + 2);
+        uint64_t hi = lo + rng() % (numIndicies / 4 + 2);
+        auto expected = tree->scan(lo, hi);
+        for (auto cursor = frozen.scan(lo, hi); cursor.valid(); cursor.next(), expected.next()) {
+            if (!expected.valid() || cursor.key() != expected.key() || cursor.value() != expected.value()) {
+                return false;
+            }
+        }
+        if (expected.valid()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Save the filled tree to a snapshot and load it into a fresh tree, which must find every
+ * inserted index and keep its leaf chain. The same snapshot with one flipped byte must be
+ * rejected.
+*/
+template <typename Tree>
+bool testSnapshot(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::unique_ptr<Tree> loaded = std::make_unique<Tree>();
+    std::stringstream snapshot;
+    try {
+        tree->save(snapshot);
+        loaded->load(snapshot);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        return false;
+    }
+    if (loaded->capacity != tree->capacity || !testLeafChain(loaded) || !testRangeScan(loaded, numIndicies)) {
+        return false;
+    }
+    for (int i = 1; i < numIndicies; i++) {
+        if (!loaded->lookUp(i).has_value() || loaded->lookUp(i) != tree->lookUp(i)) {
+            return false;
+        }
+    }
+
+    // a flipped byte in the records, and one in the first block's record count
+    for (size_t at : {snapshot.str().size() / 2, sizeof(SnapshotHeader) + 3}) {
+        std::string corrupted = snapshot.str();
+        corrupted[at] ^= 0x10;
+        std::stringstream corruptedSnapshot(corrupted);
+        try {
+            loaded->load(corruptedSnapshot);
+            return false;
+        } catch (const std::runtime_error&) {
+        }
+    }
+    return true;
+}
+
+template <typename Tree>
+bool testSnapshotView(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    auto view = tree->snapshot();
+    std::atomic<bool> writing(true);
+    std::atomic<bool> passed(true);
+    std::thread reader([&]() {
+        do {
+            uint64_t expected = 1;
+            for (auto cursor = view.scan(0, UINT64_MAX); cursor.valid(); cursor.next(), expected++) {
+                if (cursor.key() != expected || cursor.value() != valueOf(expected)) {
+                    passed = false;
+                }
+            }
+            if (expected != (uint64_t)numIndicies || view.lookUp(numIndicies)) {
+                passed = false;
+            }
+            for (int i = 1; i < numIndicies; i += 7) {
+                if (view.lookUp(i) != valueOf(i)) {
+                    passed = false;
+                }
+            }
+        } while (writing);
+    });
+
+    // every leaf changes, splits and merges while the view is read, then the tree is restored
+    for (int i = numIndicies; i < 2 * numIndicies; i++) {
+        tree->insert(typename Tree::RecordType {(uint64_t)i, valueOf(i)});
+    }
+    for (int i = 1; i < numIndicies; i++) {
+        tree->update(i, valueOf(i) + 1);
+    }
+    for (int i = numIndicies; i < 2 * numIndicies; i++) {
+        tree->remove(i);
+    }
+    for (int i = 1; i < numIndicies; i++) {
+        tree->update(i, valueOf(i));
+    }
+    writing = false;
+    reader.join();
+    if (!passed || view.size() != (uint64_t)numIndicies - 1) {
+        return false;
+    }
+
+    // a scan started under a view reads what the view was taken on
+    auto bounded = tree->snapshot();
+    tree->remove(numIndicies / 2);
+    bool found = false;
+    for (auto cursor = bounded.scan(numIndicies / 2, numIndicies / 2); cursor.valid(); cursor.next()) {
+        found = cursor.value() == valueOf(numIndicies / 2);
+    }
+    tree->insert(typename Tree::RecordType {(uint64_t)numIndicies / 2, valueOf(numIndicies / 2)});
+    return (found || numIndicies / 2 == 0) && tree->capacity == (uint64_t)numIndicies - 1 && testLeafChain(tree);
+}
+
+template <typename Tree>
+bool testServer(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    std::string path = (std::filesystem::temp_directory_path() / "btree-test.sock").string();
+    bool passed = true;
+    TreeServer<Tree> server(*tree);
+    uint16_t port;
+    try {
+        server.listenUnix(path);
+        port = server.listenTcp(0);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        return false;
+    }
+    std::thread serving([&] { server.run(); });
+
+    try {
+        TreeClient client(path);
+        for (int first = 1; first <= numIndicies; first += 1024) {
+            int last = std::min(first + 1024, numIndicies + 1);
+            for (int i = first; i < last; i++) {
+                client.lookUp(i);
+            }
+            client.flush();
+            for (int i = first; i < last; i++) {
+                TreeClient::Response response = client.next();
+                passed &= i < numIndicies ? response.status == ServerStatus::Ok && response.value == valueOf(i)
+                                          : response.status == ServerStatus::NotFound;
+            }
+        }
+
+        client.scan(1, numIndicies, 10);
+        client.insert(numIndicies, 5);
+        client.lookUp(numIndicies);
+        client.raw({2, 0, 0, 0, static_cast<char>(ServerOp::LookUp), 0}); // key cut short
+        client.remove(numIndicies);
+        client.remove(numIndicies);
+        client.flush();
+        TreeClient::Response scanned = client.next();
+        passed &= scanned.records.size() == size_t(std::min(10, numIndicies - 1));
+        for (size_t i = 0; i < scanned.records.size(); i++) {
+            passed &= scanned.records[i].first == i + 1 && scanned.records[i].second == valueOf(i + 1);
+        }
+        passed &= client.next().status == ServerStatus::Ok;
+        TreeClient::Response inserted = client.next();
+        passed &= inserted.status == ServerStatus::Ok && inserted.value == 5;
+        passed &= client.next().status == ServerStatus::Error;
+        passed &= client.next().status == ServerStatus::Ok;
+        passed &= client.next().status == ServerStatus::NotFound;
+
+        TreeClient tcpClient(port);
+        tcpClient.lookUp(1);
+        tcpClient.flush();
+        TreeClient::Response overTcp = tcpClient.next();
+        passed &= numIndicies < 2 || (overTcp.status == ServerStatus::Ok && overTcp.value == valueOf(1));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        passed = false;
+    }
+    server.stop();
+    serving.join();
+
+    // with a log, writes are only answered once they are on disk; the window is long enough
+    // that an early answer would find the log still empty
+    std::string walPath = (std::filesystem::temp_directory_path() / "btree-test-server.wal").string();
+    std::filesystem::remove(walPath);
+    try {
+        WriteAheadLog<> wal(walPath, GroupCommit {1 << 20, std::chrono::milliseconds(100)});
+        TreeServer<Tree> logged(*tree, &wal);
+        logged.listenUnix(path);
+        std::thread loggedServing([&] { logged.run(); });
+        try {
+            TreeClient client(path);
+            client.insert(numIndicies, 5);
+            client.remove(numIndicies);
+            client.flush();
+            passed &= client.next().status == ServerStatus::Ok;
+            passed &= client.next().status == ServerStatus::Ok;
+            passed &= std::filesystem::file_size(walPath) == 2 * sizeof(WriteAheadLog<>::WalRecord);
+        } catch (const std::exception& e) {
+            std::cerr << "Exception occurred: " << e.what() << std::endl;
+            passed = false;
+        }
+        logged.stop();
+        loggedServing.join();
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        passed = false;
+    }
+    std::filesystem::remove(walPath);
+    return passed && !tree->lookUp(numIndicies).has_value();
+}
+
+inline bool testKeyFile(int numIndicies) {
+    std::vector<uint64_t> keys(numIndicies);
+    for (int i = 0; i < numIndicies; i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(5));
+    std::string textPath = (std::filesystem::temp_directory_path() / "btree-test.keys.txt").string();
+    std::string binaryPath = (std::filesystem::temp_directory_path() / "btree-test.keys").string();
+    bool passed = true;
+    try {
+        {
+            std::ofstream text(textPath, std::ios::trunc);
+            text << numIndicies << "\n";
+            for (uint64_t key : keys) {
+                text << key << "\n";
+            }
+        }
+        writeKeyFile(binaryPath, keys);
+        for (unsigned threads : {1u, 4u}) {
+            passed &= readKeyFile(textPath, threads) == keys && readKeyFile(binaryPath, threads) == keys;
+        }
+        std::filesystem::resize_file(binaryPath, std::filesystem::file_size(binaryPath) - 1);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        passed = false;
+    }
+    try {
+        readKeyFile(binaryPath, 1);
+        passed = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::filesystem::remove(textPath);
+    std::filesystem::remove(binaryPath);
+    return passed;
+}
+
+/**
+ * Log every record of the filled tree, tear the last record as a crash mid write would, and
+ * replay the log into a fresh tree. The replayed tree must hold every inserted index and
+ * the torn record must be cut off.
+*/
+template <typename Tree>
+bool testWriteAheadLog(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    typedef WriteAheadLog<typename Tree::RecordType::KeyType, typename Tree::RecordType::ValueType> Log;
+    std::string path = (std::filesystem::temp_directory_path() / "btree-test.wal").string();
+    std::filesystem::remove(path);
+    std::unique_ptr<Tree> replayed = std::make_unique<Tree>();
+    uint64_t applied = 0;
+    try {
+        {
+            Log wal(path, GroupCommit {64, std::chrono::milliseconds(1)});
+            for (auto cursor = tree->scan(0, numIndicies); cursor.valid(); cursor.next()) {
+                wal.append(WalOp::Insert, cursor.key(), cursor.value());
+            }
+            wal.append(WalOp::Insert, numIndicies);
+        }
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+        Log wal(path);
+        applied = wal.replay([&](WalOp op, auto key, auto value) {
+            if (op == WalOp::Insert) {
+                replayed->insert(typename Tree::RecordType {key, value});
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        std::filesystem::remove(path);
+        return false;
+    }
+    bool passed = applied == tree->capacity && replayed->capacity == tree->capacity
+        && std::filesystem::file_size(path) == applied * sizeof(typename Log::WalRecord)
+        && !replayed->lookUp(numIndicies).has_value();
+    for (int i = 1; passed && i < numIndicies; i++) {
+        passed = replayed->lookUp(i).has_value() && replayed->lookUp(i) == tree->lookUp(i);
+    }
+    std::filesystem::remove(path);
+    return passed;
+}
+
+/**
+ * Insert the second half of the file from several writer threads while reader threads keep
+ * looking up the first half, which was inserted up front and must never go missing. Every
+ * index must be found and the leaf chain intact once all threads are done.
+*/
+template <typename Tree>
+bool testConcurrentAccess(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file, int numThreads) {
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    size_t half = indices.size() / 2;
+    for (size_t i = 0; i < half; i++) {
+        tree->insert(typename Tree::RecordType {indices[i], valueOf(indices[i])});
+    }
+
+    std::atomic<bool> writing(true);
+    std::atomic<bool> passed(true);
+    std::vector<std::thread> writers, readers;
+    for (int t = 0; t < numThreads; t++) {
+        writers.emplace_back([&, t]() {
+            for (size_t i = half + t; i < indices.size(); i += numThreads) {
+                tree->insert(typename Tree::RecordType {indices[i], valueOf(indices[i])});
+            }
+        });
+        readers.emplace_back([&, t]() {
+            do {
+                for (size_t i = t; i < half; i += numThreads) {
+                    if (tree->lookUp(indices[i]) != valueOf(indices[i])) {
+                        passed = false;
+                    }
+                }
+            } while (writing);
+        });
+    }
+    for (auto &writer : writers) {
+        writer.join();
+    }
+    writing = false;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    for (uint64_t index : indices) {
+        if (tree->lookUp(index) != valueOf(index)) {
+            return false;
+        }
+    }
+    return passed && tree->capacity == indices.size() && testLeafChain(tree);
+}
+
+inline bool testShardedTree(int numIndicies, std::ifstream &file, int numThreads) {
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+    ShardOptions options;
+    options.shards = numThreads;
+    options.rebalanceInterval = std::chrono::milliseconds(0);
+    ShardedBTree<> tree(options);
+    auto allFound = [&]() {
+        for (uint64_t index : indices) {
+            if (tree.lookUp(index) != valueOf(index)) {
+                return false;
+            }
+        }
+        std::vector<Record<uint64_t, uint64_t>> records = tree.scan(0, UINT64_MAX);
+        for (size_t i = 0; i < records.size(); i++) {
+            if (records[i].key != i + 1 || records[i].value != valueOf(i + 1)) {
+                return false;
+            }
+        }
+        return records.size() == indices.size() && !tree.lookUp(numIndicies);
+    };
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < numThreads; t++) {
+        writers.emplace_back([&, t]() {
+            for (size_t i = t; i < indices.size(); i += numThreads) {
+                tree.insert({indices[i], valueOf(indices[i])});
+            }
+        });
+    }
+    for (auto &writer : writers) {
+        writer.join();
+    }
+    if (tree.size() != indices.size() || !allFound()) {
+        return false;
+    }
+
+    if (indices.size() >= tree.shardCount() && !tree.rebalance()) {
+        return false;
+    }
+    for (const ShardStats &shard : tree.stats()) {
+        if (shard.records > indices.size() / tree.shardCount() + 1) {
+            return false;
+        }
+    }
+    if (tree.size() != indices.size() || !allFound()) {
+        return false;
+    }
+    size_t limited = std::min<size_t>(10, indices.size());
+    if (tree.scan(1, UINT64_MAX, limited).size() != limited) {
+        return false;
+    }
+
+    for (size_t i = 0; i < indices.size(); i += 2) {
+        if (!tree.remove(indices[i]) || tree.remove(indices[i]) || tree.lookUp(indices[i])) {
+            return false;
+        }
+    }
+    if (tree.size() != indices.size() / 2) {
+        return false;
+    }
+
+    // bulk loads that leave shards empty: fewer records than shards, a run of equal keys
+    // taking up the tail slices, and no records at all
+    auto loads = [&](std::vector<Record<uint64_t, uint64_t>> records) {
+        ShardedBTree<> loaded(options);
+        loaded.bulkLoad(records);
+        for (const auto &record : records) {
+            if (loaded.lookUp(record.key) != record.value) {
+                return false;
+            }
+        }
+        uint64_t fresh = records.empty() ? 1 : records.back().key + 1;
+        loaded.insert({fresh, valueOf(fresh)});
+        if (loaded.lookUp(fresh) != valueOf(fresh) || loaded.size() != records.size() + 1
+            || loaded.scan(0, UINT64_MAX).size() != records.size() + 1) {
+            return false;
+        }
+        uint64_t first = records.empty() ? fresh : records.front().key;
+        return loaded.remove(first) && loaded.size() == records.size();
+    };
+    std::vector<Record<uint64_t, uint64_t>> run = {{1, valueOf(1)}, {2, valueOf(2)}};
+    run.resize(4 * tree.shardCount(), {3, valueOf(3)});
+    return loads({{5, valueOf(5)}, {50, valueOf(50)}}) && loads(run) && loads({});
+}
+
+/**
+ * Lower and upper bound over sorted random offsets of one packed width on every search path
+ * the cpu supports, against std::lower_bound / upper_bound. Probes include the largest value
+ * of the lane, which only compares right when the sign flip does.
+*/
+template <typename Lane>
+bool testLaneSearch(std::mt19937_64 &rng) {
+    for (size_t n = 0; n <= 300; n += 7) {
+        std::vector<Lane> lanes(n);
+        for (auto &lane : lanes) {
+            lane = rng();
+        }
+        std::sort(lanes.begin(), lanes.end());
+        for (int probeIdx = 0; probeIdx < 16; probeIdx++) {
+            Lane probe = probeIdx == 0 ? Lane(~Lane()) : probeIdx == 1 ? Lane(0) : Lane(rng());
+            size_t upper = std::upper_bound(lanes.begin(), lanes.end(), probe) - lanes.begin();
+            size_t lower = std::lower_bound(lanes.begin(), lanes.end(), probe) - lanes.begin();
+            for (SearchPath path : {SearchPath::Scalar, SearchPath::SSE42, SearchPath::AVX2, SearchPath::AVX512}) {
+                if (setSearchPath(path) && (countLessEqual(lanes.data(), n, probe) != upper ||
+                                            countLess(lanes.data(), n, probe) != lower)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Every SIMD search path the cpu supports must agree with the scalar lower and upper
+ * bound on random sorted arrays, including duplicates, empty arrays and ragged tails.
+*/
+inline bool testNodeSearch() {
+    SearchPath original = activeSearchPath();
+    std::mt19937_64 rng(42);
+    bool passed = true;
+    for (size_t n = 0; n <= 300 && passed; n++) {
+        std::vector<uint64_t> keys(n);
+        for (auto &key : keys) {
+            key = rng() % (n * 2 + 1);
+        }
+        keys.push_back(UINT64_MAX);
+        std::sort(keys.begin(), keys.end());
+        for (int probeIdx = 0; probeIdx < 32 && passed; probeIdx++) {
+            uint64_t probe = probeIdx == 0 ? UINT64_MAX : rng() % (n * 2 + 3);
+            size_t upper = std::upper_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            size_t lower = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            for (SearchPath path : {SearchPath::Scalar, SearchPath::SSE42, SearchPath::AVX2, SearchPath::AVX512}) {
+                if (!setSearchPath(path)) {
+                    continue;
+                }
+                if (countLessEqual(keys.data(), keys.size(), probe) != upper ||
+                    countLess(keys.data(), keys.size(), probe) != lower) {
+                    passed = false;
+                }
+            }
+        }
+    }
+    passed = passed && testLaneSearch<uint8_t>(rng) && testLaneSearch<uint16_t>(rng) && testLaneSearch<uint32_t>(rng);
+    setSearchPath(original);
+    return passed;
+}
+
+inline bool testFrozenModel(int numIndicies) {
+    std::mt19937_64 rng(11);
+    auto check = [&](std::vector<uint64_t> keys, auto fit) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::unique_ptr<BTree<>> tree = std::make_unique<BTree<>>();
+        for (uint64_t key : keys) {
+            tree->insert(typename BTree<>::RecordType {key, valueOf(key)});
+        }
+        auto frozen = tree->freeze();
+        if (!fit(frozen.modelStats())) {
+            return false;
+        }
+        std::vector<uint64_t> probes;
+        for (uint64_t key : keys) {
+            probes.insert(probes.end(), {key - 1, key, key + 1});
+        }
+        std::vector<std::optional<uint64_t>> values(probes.size());
+        for (bool model : {true, false}) {
+            frozen.useModel(model);
+            frozen.multiGet(probes, values);
+            for (size_t i = 0; i < probes.size(); i++) {
+                if (values[i] != tree->lookUp(probes[i]) || frozen.lookUp(probes[i]) != values[i]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    std::vector<uint64_t> uniform, crowded;
+    for (int i = 1; i < numIndicies; i++) {
+        uniform.push_back(rng() % ((uint64_t)numIndicies << 20) + 1);
+        crowded.push_back(i % 2 ? i : UINT64_MAX - (uint64_t)i * i);
+    }
+    bool large = numIndicies >= 16 * FROZEN_MODEL_SEGMENT;
+    return check(uniform, [&](const FrozenModelStats &stats) { return !large || stats.fitted * 2 > stats.segments; })
+        && check(crowded, [&](const FrozenModelStats &stats) { return !large || stats.fitted < stats.segments; });
+}
+
+inline bool testStats(int numIndicies) {
+    typedef BTree<uint64_t, uint64_t, 5, 3> Tree;
+    auto count = [](const TreeStats &stats, Stat stat) { return stats.operations[static_cast<size_t>(stat)]; };
+    std::vector<uint64_t> keys;
+    for (int i = 1; i < numIndicies; i++) {
+        keys.push_back(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(7));
+
+    std::unique_ptr<Tree> tree = std::make_unique<Tree>();
+    StatsRegistry::instance().reset();
+    for (uint64_t key : keys) {
+        tree->insert(key);
+    }
+    TreeStats inserted = tree->stats();
+    bool passed = inserted.records == keys.size() && inserted.height == tree->height()
+        && inserted.leafFill > 0 && inserted.leafFill <= 1 && inserted.internalFill <= 1;
+
+    StatsRegistry::instance().reset();
+    for (uint64_t key : keys) {
+        passed &= tree->lookUp(key).has_value();
+    }
+    TreeStats lookedUp = tree->stats();
+
+    if (!statsEnabled) {
+        for (size_t i = 0; i < inserted.operations.size(); i++) {
+            passed &= inserted.operations[i] == 0 && lookedUp.operations[i] == 0;
+        }
+        return passed;
+    }
+    passed &= count(inserted, Stat::Inserts) == keys.size()
+        && count(inserted, Stat::LeafSplits) == inserted.leaves - 1
+        && count(inserted, Stat::InternalSplits) + count(inserted, Stat::RootSplits) == inserted.internalNodes
+        && count(inserted, Stat::Descents) + count(inserted, Stat::Appends) >= keys.size()
+        && count(inserted, Stat::PushUpCascades) <= count(inserted, Stat::PushUps);
+    passed &= count(lookedUp, Stat::Lookups) == keys.size()
+        && count(lookedUp, Stat::Descents) == keys.size()
+        && count(lookedUp, Stat::NodesVisited) == keys.size() * lookedUp.height
+        && count(lookedUp, Stat::Inserts) == 0;
+    return passed;
+}
+
+inline bool testAppend(int numIndicies) {
+    auto check = [&](auto tree) {
+        typedef typename decltype(tree)::element_type Tree;
+        auto insert = [&](uint64_t key) { tree->insert(typename Tree::RecordType {key, valueOf(key)}); };
+        auto complete = [&]() {
+            for (int i = 1; i < numIndicies; i++) {
+                if (tree->lookUp(i) != valueOf(i)) {
+                    return false;
+                }
+            }
+            return tree->capacity == (uint64_t)std::max(numIndicies - 1, 0) && testLeafChain(tree)
+                && testRangeScan(tree, numIndicies);
+        };
+
+        for (int i = 1; i < numIndicies; i++) {
+            if (i % 10 != 5) {
+                insert(i);
+            }
+        }
+        bool filled = numIndicies < 8 * (int)Tree::Params::leafCap || tree->stats().leafFill >= 0.75;
+        for (int i = 5; i < numIndicies; i += 10) {
+            insert(i);
+        }
+        if (!filled || !complete()) {
+            return false;
+        }
+
+        int tail = numIndicies - numIndicies / 4;
+        for (int i = tail; i < numIndicies; i++) {
+            tree->remove(i);
+        }
+        int middle = (tail + numIndicies) / 2;
+        {
+            auto view = tree->snapshot();
+            for (int i = tail; i < middle; i++) {
+                insert(i);
+            }
+        }
+        for (int i = middle; i < numIndicies; i++) {
+            insert(i);
+        }
+        return complete();
+    };
+    return check(std::make_unique<BTree<uint64_t, uint64_t, 5, 3>>()) && check(std::make_unique<BTree<>>());
+}
+
+template <typename Tree>
+bool testCompression(const std::unique_ptr<Tree> &tree, int numIndicies) {
+    size_t bytesBefore = tree->arena.bytesInUse();
+    if (tree->compress() == 0 || tree->arena.bytesInUse() >= bytesBefore) {
+        return false;
+    }
+    for (int i = 1; i < numIndicies; i++) {
+        if (tree->lookUp(i) != valueOf(i)) {
+            return false;
+        }
+    }
+    if (!testLeafChain(tree) || !testRangeScan(tree, numIndicies)) {
+        return false;
+    }
+
+    std::unique_ptr<Tree> loaded = std::make_unique<Tree>();
+    std::stringstream snapshot;
+    try {
+        tree->save(snapshot);
+        loaded->load(snapshot);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception occurred: " << e.what() << std::endl;
+        return false;
+    }
+    if (loaded->capacity != tree->capacity || !testLeafChain(loaded) || loaded->lookUp(1) != valueOf(1)) {
+        return false;
+    }
+
+    uint64_t added = numIndicies + 1;
+    tree->insert(typename Tree::RecordType {added, valueOf(added)});
+    bool passed = tree->lookUp(added) == valueOf(added) && tree->update(1, 0) && tree->lookUp(1) == 0
+        && tree->remove(added) && !tree->remove(added) && tree->update(1, valueOf(1));
+    tree->compress();
+    return passed && tree->arena.bytesInUse() < bytesBefore && tree->lookUp(1) == valueOf(1) && testLeafChain(tree);
+}
+
+/**
+ * Remove the indices of the file from the filled tree in file order, half first and then
+ * the rest. Removed indices must be gone and the others in place after each half; once
+ * empty the tree must have collapsed back to a single leaf and take the indices again.
+*/
+template <typename Tree>
+bool testRemove(const std::unique_ptr<Tree> &tree, int numIndicies, std::ifstream &file) {
+    std::vector<uint64_t> indices;
+    indices.reserve(numIndicies);
+    if (!readIndices(file, indices)) {
+        return false;
+    }
+
+    std::vector<bool> removed(numIndicies + 1);
+    auto removeRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!tree->remove(indices[i]) || tree->remove(indices[i])) {
+                return false;
+            }
+            removed[indices[i]] = true;
+        }
+        uint64_t remaining = 0, prevKey = 0;
+        for (auto cursor = tree->scan(0, numIndicies); cursor.valid(); cursor.next()) {
+            if (cursor.key() <= prevKey || removed[cursor.key()]) {
+                return false;
+            }
+            prevKey = cursor.key();
+            remaining++;
+        }
+        for (uint64_t index : indices) {
+            if (tree->lookUp(index).has_value() == removed[index]) {
+                return false;
+            }
+        }
+        return remaining == tree->capacity && remaining == indices.size() - end;
+    };
+
+    if (!removeRange(0, indices.size() / 2) || !removeRange(indices.size() / 2, indices.size())) {
+        return false;
+    }
+    if (tree->height() != 1 || tree->remove(1)) {
+        return false;
+    }
+    for (uint64_t index : indices) {
+        tree->insert(typename Tree::RecordType {index});
+    }
+    for (uint64_t index : indices) {
+        if (!tree->lookUp(index).has_value()) {
+            return false;
+        }
+    }
+    return tree->capacity == indices.size();
+}
\ No newline at end of file
@@ -0,0 +1,391 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "btree.h"
+
+/**
+ * Point in time view of a BTree returned by BTree::snapshot. Every node it reaches is shared
+ * with the live tree and never changed again while the view lives; writers copy a shared node
+ * before changing it. Readers only look at keys, values and child handles: the parent and
+ * leaf chain links of shared nodes keep following the live tree, so scans walk down from the
+ * view's root instead of along the chain.
+ *
+ * Any number of threads may read one view at once, also while a single writer keeps changing
+ * the tree. Views are released by destruction, on any thread.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+class SnapshotView {
+public:
+    typedef BTree<Key, Value, LeafCap, InnerCap> Tree;
+    typedef typename Tree::Params Params;
+    typedef typename Tree::RecordType RecordType;
+    typedef typename Tree::Leaf Leaf;
+    typedef typename Tree::Internal Internal;
+
+    /**
+     * Ascending position inside [lo, hi], turning invalid past hi or the last record. The
+     * path from the root is kept so the next leaf is found without the leaf chain.
+    */
+    class Cursor {
+    public:
+        Cursor(const NodeArena<Params> *arena, NodeHandle root, Key lo, Key hi);
+
+        inline bool valid() const { return leaf && !(hi < leaf->key(slot)); }
+        inline Key key() const { return leaf->key(slot); }
+        inline Value value() const { return leaf->value(slot); }
+        inline RecordType record() const { return RecordType {key(), value()}; }
+        void next();
+
+    private:
+        struct Level {
+            Internal *node;
+            size_t slot; // of the child the cursor is under
+        };
+
+        const NodeArena<Params> *arena;
+        std::vector<Level> path;
+        Leaf *leaf;
+        size_t slot;
+        Key hi;
+
+        void descend(NodeHandle handle, Key lo);
+        void nextLeaf();
+    };
+
+    SnapshotView(SnapshotView &&other) noexcept;
+    SnapshotView& operator=(SnapshotView &&other) noexcept;
+    SnapshotView(const SnapshotView&) = delete;
+    SnapshotView& operator=(const SnapshotView&) = delete;
+    ~SnapshotView();
+
+    std::optional<Value> lookUp(Key key) const; // empty when key was not in the tree
+    Cursor scan(Key lo, Key hi) const;          // ascending from the first key >= lo
+    inline uint64_t size() const { return records; }
+
+private:
+    friend class BTree<Key, Value, LeafCap, InnerCap>;
+    SnapshotView(Tree *tree, NodeHandle root, uint64_t epoch, uint64_t records);
+
+    Tree *tree; // null once moved from
+    NodeHandle root;
+    uint64_t epoch, records;
+
+    void release();
+};
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap>::SnapshotView(Tree *tree, NodeHandle root, uint64_t epoch, uint64_t records)
+    : tree(tree), root(root), epoch(epoch), records(records) {}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap>::SnapshotView(SnapshotView &&other) noexcept
+    : tree(other.tree), root(other.root), epoch(other.epoch), records(other.records) {
+    other.tree = nullptr;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap>& SnapshotView<Key, Value, LeafCap, InnerCap>::operator=(SnapshotView &&other) noexcept {
+    if (this != &other) {
+        release();
+        tree = other.tree;
+        root = other.root;
+        epoch = other.epoch;
+        records = other.records;
+        other.tree = nullptr;
+    }
+    return *this;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap>::~SnapshotView() {
+    release();
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void SnapshotView<Key, Value, LeafCap, InnerCap>::release() {
+    if (!tree) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(tree->snapshots.mutex);
+    tree->snapshots.live.erase(tree->snapshots.live.find(epoch));
+    // pairs with the acquire in reclaim, every read of this view happens before a free
+    tree->snapshots.count.fetch_sub(1, std::memory_order_release);
+    tree = nullptr;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+std::optional<Value> SnapshotView<Key, Value, LeafCap, InnerCap>::lookUp(Key key) const {
+    NodeHandle handle = root;
+    while (!NodeArena<Params>::isLeaf(handle)) {
+        handle = tree->arena.internal(handle)->findChildPtr(key);
+    }
+    Leaf *leafNode = tree->arena.leaf(handle);
+    size_t slot = leafNode->lowerBound(key);
+    if (slot < leafNode->size() && leafNode->key(slot) == key) {
+        return leafNode->value(slot);
+    }
+    return std::nullopt;
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename SnapshotView<Key, Value, LeafCap, InnerCap>::Cursor SnapshotView<Key, Value, LeafCap, InnerCap>::scan(Key lo, Key hi) const {
+    return Cursor(&tree->arena, root, lo, hi);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap>::Cursor::Cursor(const NodeArena<Params> *arena, NodeHandle root, Key lo, Key hi)
+    : arena(arena), leaf(nullptr), slot(0), hi(hi) {
+    descend(root, lo);
+    if (slot == leaf->size()) {
+        nextLeaf();
+    }
+}
+
+/**
+ * Walk down to the leaf holding lo, the leftmost leaf below handle for the smallest key.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void SnapshotView<Key, Value, LeafCap, InnerCap>::Cursor::descend(NodeHandle handle, Key lo) {
+    while (!NodeArena<Params>::isLeaf(handle)) {
+        Internal *internalNode = arena->internal(handle);
+        size_t childSlot = keyUpperBound(internalNode->keys.data(), internalNode->keys.size(), lo);
+        path.push_back({internalNode, childSlot});
+        handle = internalNode->child(childSlot);
+    }
+    leaf = arena->leaf(handle);
+    slot = leaf->lowerBound(lo);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void SnapshotView<Key, Value, LeafCap, InnerCap>::Cursor::next() {
+    if (++slot == leaf->size()) {
+        nextLeaf();
+    }
+}
+
+/**
+ * Back up to the nearest ancestor with a child right of the path and take the leftmost leaf
+ * below that child, skipping empty leaves. Past the last leaf the cursor turns invalid.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void SnapshotView<Key, Value, LeafCap, InnerCap>::Cursor::nextLeaf() {
+    do {
+        while (!path.empty() && path.back().slot == path.back().node->keys.size()) {
+            path.pop_back();
+        }
+        if (path.empty()) {
+            leaf = nullptr;
+            return;
+        }
+        NodeHandle handle = path.back().node->child(++path.back().slot);
+        while (!NodeArena<Params>::isLeaf(handle)) {
+            Internal *internalNode = arena->internal(handle);
+            path.push_back({internalNode, 0});
+            handle = internalNode->ltChildPtr;
+        }
+        leaf = arena->leaf(handle);
+        slot = 0;
+    } while (leaf->size() == 0);
+}
+
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+SnapshotView<Key, Value, LeafCap, InnerCap> BTree<Key, Value, LeafCap, InnerCap>::snapshot() {
+    uint64_t epoch = arena.epoch++;
+    frozenEpoch = epoch;
+    std::lock_guard<std::mutex> guard(snapshots.mutex);
+    snapshots.live.insert(epoch);
+    snapshots.count.fetch_add(1, std::memory_order_relaxed);
+    return SnapshotView<Key, Value, LeafCap, InnerCap>(this, rootNode, epoch, capacity);
+}
+
+/**
+ * Replace a shared node with a private copy: its parent is made private first (and so on up
+ * to the root) and pointed at the copy, children and leaf neighbours are relinked to it and
+ * the original is retired. Unshared nodes are returned as they are, so a path copy stops at
+ * the first ancestor copied before. A shared packed leaf is copied to a plain one.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+NodeHandle BTree<Key, Value, LeafCap, InnerCap>::unshare(NodeHandle handle) {
+    if (!isShared(handle)) {
+        return handle;
+    }
+    NodeHandle parentHandle = arena.node(handle)->parent;
+    if (parentHandle != NULL_HANDLE) {
+        unshare(parentHandle); // relinks handle to the parent's copy
+    }
+
+    NodeHandle copy;
+    if (NodeArena<Params>::isLeaf(handle)) {
+        copy = copyLeaf(handle);
+    } else {
+        copy = arena.newInternal(arena.internal(handle)->maxCap);
+        Internal *original = arena.internal(handle), *internalCopy = arena.internal(copy);
+        internalCopy->keys = original->keys;
+        internalCopy->gtChildren = original->gtChildren;
+        internalCopy->ltChildPtr = original->ltChildPtr;
+        internalCopy->curCap = original->curCap;
+        arena.node(internalCopy->ltChildPtr)->parent = copy;
+        for (NodeHandle child : internalCopy->gtChildren) {
+            arena.node(child)->parent = copy;
+        }
+    }
+    replaceNode(handle, copy);
+    return copy;
+}
+
+/**
+ * New plain leaf holding the records of the leaf at handle, which may be packed. Not linked
+ * anywhere yet, see replaceNode.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+NodeHandle BTree<Key, Value, LeafCap, InnerCap>::copyLeaf(NodeHandle handle) {
+    Leaf *original = arena.leaf(handle);
+    NodeHandle copy = arena.newLeaf(original->maxCap);
+    PlainLeaf *leafCopy = arena.plainLeaf(copy);
+    leafCopy->keys.resize(original->size());
+    leafCopy->values.resize(original->size());
+    original->copyTo(leafCopy->keys.data(), leafCopy->values.data());
+    leafCopy->curCap = original->size();
+    return copy;
+}
+
+/**
+ * Put copy in the place of handle: under its parent, which must be private, or as the root,
+ * and for a leaf also in the chain between its neighbours. The original is retired.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::replaceNode(NodeHandle handle, NodeHandle copy) {
+    NodeHandle parentHandle = arena.node(handle)->parent;
+    arena.node(copy)->parent = parentHandle;
+    if (parentHandle == NULL_HANDLE) {
+        rootNode = copy;
+    } else {
+        Internal *parentNode = arena.internal(parentHandle);
+        if (parentNode->ltChildPtr == handle) {
+            parentNode->ltChildPtr = copy;
+        } else {
+            *std::find(parentNode->gtChildren.begin(), parentNode->gtChildren.end(), handle) = copy;
+        }
+    }
+    if (NodeArena<Params>::isLeaf(handle)) {
+        Leaf *original = arena.leaf(handle), *leafCopy = arena.leaf(copy);
+        leafCopy->prevLeaf = original->prevLeaf;
+        leafCopy->nextLeaf = original->nextLeaf;
+        if (original->prevLeaf != NULL_HANDLE) {
+            arena.leaf(original->prevLeaf)->nextLeaf = copy;
+        }
+        if (original->nextLeaf != NULL_HANDLE) {
+            arena.leaf(original->nextLeaf)->prevLeaf = copy;
+        }
+    }
+    retire(handle);
+}
+
+/**
+ * The node at handle made ready to change: copied together with its shared ancestors if a
+ * view still shares it, and a packed leaf replaced by a plain copy.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+NodeHandle BTree<Key, Value, LeafCap, InnerCap>::writable(NodeHandle handle) {
+    if (isShared(handle)) {
+        return unshare(handle);
+    }
+    if (NodeArena<Params>::isPacked(handle)) {
+        NodeHandle copy = copyLeaf(handle);
+        replaceNode(handle, copy);
+        return copy;
+    }
+    return handle;
+}
+
+/**
+ * The leaf about to change, see writable(NodeHandle). Views released since the last write
+ * are accounted for first.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+typename BTree<Key, Value, LeafCap, InnerCap>::PlainLeaf* BTree<Key, Value, LeafCap, InnerCap>::writable(Leaf *leafNode) {
+    if (frozenEpoch) {
+        reclaim();
+    }
+    return arena.plainLeaf(writable(leafNode->id));
+}
+
+/**
+ * Free a node that left the tree, or hold on to it while a view may still reach it.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::retire(NodeHandle handle) {
+    if (handle == appendHint) {
+        appendHint = NULL_HANDLE;
+    }
+    if (isShared(handle)) {
+        retired.push_back({arena.epoch, handle});
+    } else {
+        arena.release(handle);
+    }
+}
+
+/**
+ * A node retired at epoch e is only reachable from views taken before e, so it is freed once
+ * the oldest live view is at least e. With no views left everything goes at once and
+ * nothing counts as shared any more; otherwise the check waits for RECLAIM_BATCH retirees.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::reclaim() {
+    uint64_t oldest = UINT64_MAX;
+    if (snapshots.count.load(std::memory_order_acquire) != 0) {
+        if (retired.size() < RECLAIM_BATCH) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(snapshots.mutex);
+        if (!snapshots.live.empty()) {
+            oldest = *snapshots.live.begin();
+            frozenEpoch = *snapshots.live.rbegin();
+        }
+    }
+    if (oldest == UINT64_MAX) {
+        frozenEpoch = 0;
+    }
+    size_t freed = 0;
+    while (freed < retired.size() && retired[freed].first <= oldest) {
+        arena.release(retired[freed++].second);
+    }
+    retired.erase(retired.begin(), retired.begin() + freed);
+}
+
+/**
+ * Drop every node ahead of a rebuild from scratch. While views are live the nodes are retired
+ * one by one instead, internal ones found from the root and leaves along the chain, which
+ * also covers a rebuild that failed before its internal levels existed.
+*/
+template <typename Key, typename Value, size_t LeafCap, size_t InnerCap>
+void BTree<Key, Value, LeafCap, InnerCap>::clearNodes() {
+    appendHint = NULL_HANDLE;
+    if (frozenEpoch) {
+        reclaim();
+    }
+    if (!frozenEpoch) {
+        retired.clear();
+        arena.clear();
+        return;
+    }
+    NodeHandle leafHandle = leftmostLeaf()->id;
+    std::vector<NodeHandle> pending = {rootNode};
+    while (!pending.empty()) {
+        NodeHandle handle = pending.back();
+        pending.pop_back();
+        if (!NodeArena<Params>::isLeaf(handle)) {
+            Internal *internalNode = arena.internal(handle);
+            pending.push_back(internalNode->ltChildPtr);
+            pending.insert(pending.end(), internalNode->gtChildren.begin(), internalNode->gtChildren.end());
+            retire(handle);
+        }
+    }
+    while (leafHandle != NULL_HANDLE) {
+        NodeHandle next = arena.leaf(leafHandle)->nextLeaf;
+        retire(leafHandle);
+        leafHandle = next;
+    }
+}
+
+#endif
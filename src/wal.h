@@ -0,0 +1,273 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "btree.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * When buffered log records are made durable: as soon as maxRecords are pending or the
+ * oldest pending record has waited window, whichever comes first. One fdatasync covers the
+ * whole group, maxRecords = 1 gives one sync per record.
+*/
+struct GroupCommit {
+    size_t maxRecords = 256;
+    std::chrono::milliseconds window = std::chrono::milliseconds(5);
+};
+
+enum class WalOp : uint8_t { Insert = 1, Remove = 2 };
+
+/**
+ * Append only redo log of tree mutations. Records have a fixed size and their own checksum,
+ * so a record torn by a crash is detected on replay and cut off.
+ *
+ * append() only copies the record into a buffer; a flusher thread writes and syncs the
+ * buffer per GroupCommit while further appends continue. Callers that must not acknowledge
+ * before the record is on disk wait with waitDurable() on the sequence number append()
+ * returned.
+*/
+template <typename Key = uint64_t, typename Value = uint64_t>
+class WriteAheadLog {
+public:
+    struct WalRecord {
+        uint64_t checksum; // of the fields below
+        WalOp op;
+        Key key;
+        Value value;
+    };
+
+    WriteAheadLog(const std::string &path, GroupCommit policy = GroupCommit());
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /**
+     * Call apply(op, key, value) for every intact record in log order and cut off anything
+     * after the first damaged one. Must run before the first append. Returns the number of
+     * records applied.
+    */
+    template <typename Fn>
+    uint64_t replay(Fn &&apply);
+
+    uint64_t append(WalOp op, Key key, Value value = Value());
+    void waitDurable(uint64_t sequence);
+    void sync();     // make everything appended so far durable
+    void truncate(); // drop every record once a checkpoint made them redundant, not during appends
+
+private:
+    std::string path;
+    GroupCommit policy;
+    int fd;
+
+    std::mutex mutex;
+    std::condition_variable flushNeeded, flushed;
+    std::vector<WalRecord> pending;
+    std::chrono::steady_clock::time_point oldestPending;
+    uint64_t appended, durable;
+    bool syncRequested, stopping, failed;
+    std::thread flusher;
+
+    void flushLoop();
+    bool writeAll(const void *data, size_t bytes);
+    void checkFailed();
+    static uint64_t recordChecksum(const WalRecord &record);
+};
+
+/**
+ * fsync a file that was written through a stream, which has no way to do it itself.
+*/
+inline void syncPath(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("can not sync " + path);
+    }
+    close(fd);
+}
+
+template <typename Key, typename Value>
+WriteAheadLog<Key, Value>::WriteAheadLog(const std::string &path, GroupCommit policy)
+    : path(path), policy(policy), appended(0), durable(0), syncRequested(false), stopping(false), failed(false) {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "log records store keys and values as raw bytes");
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("can not open write-ahead log " + path);
+    }
+    flusher = std::thread(&WriteAheadLog::flushLoop, this);
+}
+
+template <typename Key, typename Value>
+WriteAheadLog<Key, Value>::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    flushNeeded.notify_one();
+    flusher.join(); // flushes whatever is still pending on the way out
+    close(fd);
+}
+
+template <typename Key, typename Value>
+uint64_t WriteAheadLog<Key, Value>::recordChecksum(const WalRecord &record) {
+    // hash field by field, padding bytes are not guaranteed to survive a copy
+    unsigned char fields[1 + sizeof(Key) + sizeof(Value)];
+    fields[0] = static_cast<unsigned char>(record.op);
+    std::memcpy(fields + 1, &record.key, sizeof(Key));
+    std::memcpy(fields + 1 + sizeof(Key), &record.value, sizeof(Value));
+    return snapshotChecksum(fields, sizeof(fields));
+}
+
+template <typename Key, typename Value>
+template <typename Fn>
+uint64_t WriteAheadLog<Key, Value>::replay(Fn &&apply) {
+    std::vector<WalRecord> chunk(4096);
+    off_t offset = 0;
+    uint64_t applied = 0;
+    while (true) {
+        ssize_t bytes = pread(fd, chunk.data(), chunk.size() * sizeof(WalRecord), offset);
+        if (bytes < 0) {
+            throw std::runtime_error("can not read write-ahead log " + path);
+        }
+        size_t records = bytes / sizeof(WalRecord);
+        size_t intact = 0;
+        while (intact < records && chunk[intact].checksum == recordChecksum(chunk[intact])) {
+            apply(chunk[intact].op, chunk[intact].key, chunk[intact].value);
+            intact++;
+        }
+        offset += intact * sizeof(WalRecord);
+        applied += intact;
+        if (intact < chunk.size()) {
+            break; // end of log, a partial record or a damaged one
+        }
+    }
+    if (ftruncate(fd, offset) != 0) {
+        throw std::runtime_error("can not cut torn tail of write-ahead log " + path);
+    }
+    return applied;
+}
+
+template <typename Key, typename Value>
+uint64_t WriteAheadLog<Key, Value>::append(WalOp op, Key key, Value value) {
+    WalRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.op = op;
+    record.key = key;
+    record.value = value;
+    record.checksum = recordChecksum(record);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    checkFailed();
+    if (pending.empty()) {
+        oldestPending = std::chrono::steady_clock::now();
+        flushNeeded.notify_one(); // start the window
+    }
+    pending.push_back(record);
+    if (pending.size() >= policy.maxRecords) {
+        flushNeeded.notify_one();
+    }
+    return ++appended;
+}
+
+template <typename Key, typename Value>
+void WriteAheadLog<Key, Value>::waitDurable(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [&] { return failed || durable >= sequence; });
+    checkFailed();
+}
+
+template <typename Key, typename Value>
+void WriteAheadLog<Key, Value>::sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t target = appended;
+    syncRequested = true;
+    flushNeeded.notify_one();
+    flushed.wait(lock, [&] { return failed || durable >= target; });
+    checkFailed();
+}
+
+template <typename Key, typename Value>
+void WriteAheadLog<Key, Value>::truncate() {
+    sync();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+        throw std::runtime_error("can not truncate write-ahead log " + path);
+    }
+}
+
+template <typename Key, typename Value>
+bool WriteAheadLog<Key, Value>::writeAll(const void *data, size_t bytes) {
+    const char *in = static_cast<const char*>(data);
+    while (bytes) {
+        ssize_t written = write(fd, in, bytes);
+        if (written < 0) {
+            return false;
+        }
+        in += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+/**
+ * Once a group failed to reach the disk nothing appended after it can be durable either,
+ * every later call reports the failure.
+*/
+template <typename Key, typename Value>
+void WriteAheadLog<Key, Value>::checkFailed() {
+    if (failed) {
+        throw std::runtime_error("write-ahead log " + path + " failed to write or sync");
+    }
+}
+
+/**
+ * Sleeps until a group is complete, its window ran out, a sync was asked for or the log
+ * closes. The mutex is dropped around write and fdatasync so appends are never blocked
+ * behind the disk.
+*/
+template <typename Key, typename Value>
+void WriteAheadLog<Key, Value>::flushLoop() {
+    std::vector<WalRecord> group;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        auto groupReady = [&] {
+            return stopping || syncRequested || pending.size() >= policy.maxRecords
+                || (!pending.empty() && std::chrono::steady_clock::now() - oldestPending >= policy.window);
+        };
+        if (pending.empty()) {
+            flushNeeded.wait(lock, [&] { return stopping || syncRequested || !pending.empty(); });
+        }
+        if (!groupReady()) {
+            flushNeeded.wait_until(lock, oldestPending + policy.window, groupReady);
+        }
+        if (pending.empty() && stopping) {
+            return;
+        }
+        syncRequested = false;
+        group.swap(pending);
+        uint64_t groupEnd = appended;
+
+        lock.unlock();
+        bool written = writeAll(group.data(), group.size() * sizeof(WalRecord)) && fdatasync(fd) == 0;
+        group.clear();
+        lock.lock();
+
+        if (!written) {
+            failed = true;
+            flushed.notify_all();
+            return;
+        }
+        durable = groupEnd;
+        flushed.notify_all();
+    }
+}
+
+#endif
@@ -1,6 +1,9 @@
 # Script to generate test cases
-# Usage: python3 gen.py <out_file> <n_records> (-s|-r) 
+# Usage: python3 gen.py <out_file> <n_records> (-s|-r) [--binary]
+# --binary writes a binary key file instead of text: the 8 byte magic "BTKEYS1\0", the key
+# count as a little endian uint64 and then every key as a little endian uint64.
 
+import array
 import random 
 import sys
 
@@ -9,17 +12,26 @@ if __name__ == "__main__":
     size = 10
     file_name = "in.txt"
     mode = "-s"
+    binary = "--binary" in sys.argv[4:]
 
     if len(sys.argv) > 1: 
         file_name = sys.argv[1]
         size = int(sys.argv[2])
         mode = sys.argv[3]
 
-    with open(file_name, "w") as file:
-        if mode == "-r":
-            numbers = random.sample(range(size), size) 
+    numbers = random.sample(range(size), size) if mode == "-r" else range(size)
+
+    if binary:
+        keys = array.array("Q", numbers)
+        count = array.array("Q", [size])
+        if sys.byteorder == "big":
+            keys.byteswap()
+            count.byteswap()
+        with open(file_name, "wb") as file:
+            file.write(b"BTKEYS1\0")
+            file.write(count.tobytes())
+            file.write(keys.tobytes())
+    else:
+        with open(file_name, "w") as file:
             for x in numbers:
                 file.write(str(x) + "\n")
-        elif mode == "-s":
-            for i in range(size): 
-                file.write(str(i) + "\n")
\ No newline at end of file
@@ -21,15 +21,15 @@ def compile_btree():
 def print_colored(text, color):
     print(f"\033[{color}m{text}\033[0m")
 
-def run_test(test_file):
-    run_proc = subprocess.run(['./btree', '-t', os.path.join("tests", test_file)], 
+def run_test(test_file, mode='-t'):
+    run_proc = subprocess.run(['./btree', mode, os.path.join("tests", test_file)], 
                               cwd=src_dir,
                               stdout=subprocess.PIPE,
                               stderr=subprocess.PIPE,
                               text=True)  
 
     print('-'*20) 
-    print(test_file)
+    print(test_file, mode)
     if run_proc.returncode == 0:
         results = json.loads(str(run_proc.stdout))
         for test, result in results.items():
@@ -58,4 +58,5 @@ if __name__ == "__main__":
     
     for file in test_files:
         if (file.endswith(".txt")):
-            run_test(file)
\ No newline at end of file
+            run_test(file)
+            run_test(file, '-l')
\ No newline at end of file